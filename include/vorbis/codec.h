@@ -147,6 +147,12 @@ typedef struct vorbis_comment{
 
 } vorbis_comment;
 
+/* a comment header read in place: the vendor string and comments are
+   (pointer, length) views into the caller's packet, which must outlive
+   the view.  Nothing is copied, and the tag index behind the query
+   functions is built on the first query */
+typedef struct vorbis_comment_view vorbis_comment_view;
+
 
 /* libvorbis encodes in two abstraction layers; first we perform DSP
    and produce a packet (see docs/analysis.txt).  The packet is then
@@ -165,6 +171,8 @@ typedef struct vorbis_comment{
 extern void     vorbis_info_init(vorbis_info *vi);
 extern void     vorbis_info_clear(vorbis_info *vi);
 extern int      vorbis_info_blocksize(vorbis_info *vi,int zo);
+extern int      vorbis_info_share(vorbis_info *vi);
+extern int      vorbis_info_copy(vorbis_info *vi,vorbis_info *src);
 extern void     vorbis_comment_init(vorbis_comment *vc);
 extern void     vorbis_comment_add(vorbis_comment *vc, const char *comment);
 extern void     vorbis_comment_add_tag(vorbis_comment *vc,
@@ -173,6 +181,19 @@ extern char    *vorbis_comment_query(vorbis_comment *vc, const char *tag, int co
 extern int      vorbis_comment_query_count(vorbis_comment *vc, const char *tag);
 extern void     vorbis_comment_clear(vorbis_comment *vc);
 
+extern vorbis_comment_view *vorbis_comment_view_new(ogg_packet *op);
+extern const char *vorbis_comment_view_vendor(vorbis_comment_view *cv,
+                                              int *length);
+extern int      vorbis_comment_view_comments(vorbis_comment_view *cv);
+extern const char *vorbis_comment_view_get(vorbis_comment_view *cv,int i,
+                                           int *length);
+extern const char *vorbis_comment_view_query(vorbis_comment_view *cv,
+                                             const char *tag,int count,
+                                             int *length);
+extern int      vorbis_comment_view_query_count(vorbis_comment_view *cv,
+                                                const char *tag);
+extern void     vorbis_comment_view_free(vorbis_comment_view *cv);
+
 extern int      vorbis_block_init(vorbis_dsp_state *v, vorbis_block *vb);
 extern int      vorbis_block_clear(vorbis_block *vb);
 extern void     vorbis_dsp_clear(vorbis_dsp_state *v);
@@ -192,7 +213,18 @@ extern int      vorbis_analysis_headerout(vorbis_dsp_state *v,
                                           ogg_packet *op_code);
 extern float  **vorbis_analysis_buffer(vorbis_dsp_state *v,int vals);
 extern int      vorbis_analysis_wrote(vorbis_dsp_state *v,int vals);
+extern int      vorbis_analysis_write_interleaved_f32(vorbis_dsp_state *v,
+                                          const float *pcm,int samples);
+extern int      vorbis_analysis_write_interleaved_s16(vorbis_dsp_state *v,
+                                          const ogg_int16_t *pcm,
+                                          int samples);
+extern int      vorbis_analysis_write_interleaved_s24(vorbis_dsp_state *v,
+                                          const unsigned char *pcm,
+                                          int samples);
 extern int      vorbis_analysis_blockout(vorbis_dsp_state *v,vorbis_block *vb);
+extern int      vorbis_analysis_blockout_follow(vorbis_dsp_state *v,
+                                                vorbis_block *vb,
+                                                vorbis_block *lead);
 extern int      vorbis_analysis(vorbis_block *vb,ogg_packet *op);
 
 extern int      vorbis_bitrate_addblock(vorbis_block *vb);
@@ -203,6 +235,8 @@ extern int      vorbis_bitrate_flushpacket(vorbis_dsp_state *vd,
 extern int      vorbis_synthesis_idheader(ogg_packet *op);
 extern int      vorbis_synthesis_headerin(vorbis_info *vi,vorbis_comment *vc,
                                           ogg_packet *op);
+extern int      vorbis_synthesis_headercheck(ogg_packet *id,ogg_packet *setup,
+                                             long *bytes);
 
 extern int      vorbis_synthesis_init(vorbis_dsp_state *v,vorbis_info *vi);
 extern int      vorbis_synthesis_restart(vorbis_dsp_state *v);
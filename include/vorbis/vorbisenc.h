@@ -219,6 +219,80 @@ extern int vorbis_encode_setup_init(vorbis_info *vi);
  */
 extern int vorbis_encode_ctl(vorbis_info *vi,int number,void *arg);
 
+/**
+ * Frees the psychoacoustic lookup tables kept for reuse by encoders that
+ * have since been cleared.  Tables still in use are not affected.  This may
+ * be called from any thread at any time.
+ */
+extern void vorbis_encode_cache_flush(void);
+
+/**
+ * An opaque, frozen encoder configuration.  It holds a complete encoding
+ * setup along with the encode codebooks and packed setup header built from
+ * it, so that any number of encoders can be set up from it without repeating
+ * that work.  A configuration is read-only once made and may be used from
+ * several threads at once.
+ */
+typedef struct vorbis_encode_config vorbis_encode_config;
+
+/**
+ * This function freezes a finished encoding setup into a configuration.
+ *
+ * \p vi must have completed setup through vorbis_encode_setup_init(),
+ * vorbis_encode_init() or vorbis_encode_init_vbr().  The configuration takes
+ * over the setup; \p vi remains usable for encoding exactly as before and
+ * must still be cleared with vorbis_info_clear().
+ *
+ * \param vi Pointer to a \ref vorbis_info struct with a finished encoding setup.
+ *
+ * \return The new configuration, or NULL if \p vi holds no finished
+ * encoding setup.
+ */
+extern vorbis_encode_config *vorbis_encode_config_new(vorbis_info *vi);
+
+/**
+ * Convenience function that builds and freezes the variable bitrate setup
+ * vorbis_encode_init_vbr() would make.
+ *
+ * \param channels     The number of channels to be encoded.
+ * \param rate         The sampling rate of the source audio.
+ * \param base_quality Desired quality level, currently from -0.1 to 1.0 (lo to hi).
+ *
+ * \return The new configuration, or NULL for an invalid or unimplemented
+ * request.
+ */
+extern vorbis_encode_config *vorbis_encode_config_vbr(long channels,
+                                                      long rate,
+                                                      float base_quality);
+
+/**
+ * This function sets up \p vi for encoding from a frozen configuration.
+ * The parameters and codebooks are shared with the configuration rather than
+ * copied, and vorbis_analysis_headerout() reuses its packed setup header.
+ * The result encodes bit for bit as the original setup did.
+ *
+ * Before this function is called, the \ref vorbis_info struct should be
+ * initialized by using vorbis_info_init() from the libvorbis API.  After
+ * encoding, vorbis_info_clear() should be called.  \p vi may only be used
+ * for encoding and no further setup changes are possible.
+ *
+ * \param vi  Pointer to an initialized \ref vorbis_info struct.
+ * \param cfg The configuration to encode from.
+ *
+ * \retval 0         Success.
+ * \retval OV_EINVAL \p vi was already set up.
+ */
+extern int vorbis_encode_init_config(vorbis_info *vi,
+                                     vorbis_encode_config *cfg);
+
+/**
+ * Releases the caller's reference to a configuration.  Encoders set up from
+ * it keep it alive until they are cleared with vorbis_info_clear().
+ *
+ * \param cfg The configuration to release.
+ */
+extern void vorbis_encode_config_free(vorbis_encode_config *cfg);
+
 /**
  * \deprecated This is a deprecated interface. Please use vorbis_encode_ctl()
  * with the \ref ovectl_ratemanage2_arg struct and \ref
@@ -289,6 +363,28 @@ struct ovectl_ratemanage2_arg {
   double bitrate_average_damping;
 };
 
+/**
+ * \name struct ovectl_packetblobs_arg
+ *
+ * The ovectl_packetblobs_arg structure is used with vorbis_encode_ctl() and
+ * the OV_ECTL_PACKETBLOBS_GET and OV_ECTL_PACKETBLOBS_SET calls in order to
+ * choose how a bitrate managed encoder produces the candidate encodings of
+ * each block that the bitrate manager picks from.  It has no effect on VBR
+ * encoding and never changes the encoded stream.
+ *
+*/
+struct ovectl_packetblobs_arg {
+/** Nonzero encodes only the candidates the bitrate manager actually looks
+ *  at, starting from the current average and moving outward.  Takes
+ *  precedence over threads.
+ */
+  int    lazy;
+/** Number of threads (including the calling thread) to encode all
+ *  candidates with; 0 or 1 encodes them serially.  Ignored where the
+ *  library was built without thread support.
+ */
+  int    threads;
+};
 
 /**
  * \name vorbis_encode_ctl() codes
@@ -378,6 +474,75 @@ struct ovectl_ratemanage2_arg {
  */
 #define OV_ECTL_COUPLING_SET         0x41
 
+/**
+ *  Returns in the long pointed to by arg the worst case delay, in samples
+ *  per channel, between submitting a sample to the encoder and getting
+ *  the packet that lets a decoder finish reconstructing it.  Reflects any
+ *  cap set with \ref OV_ECTL_LATENCY_SET.  Valid once an encoding mode
+ *  has been chosen.
+ *
+ * Argument: <tt>long *</tt>
+*/
+#define OV_ECTL_LATENCY_GET          0x60
+
+/**
+ *  Caps the encoder delay (as reported by \ref OV_ECTL_LATENCY_GET) to
+ *  the number of samples pointed to by arg; zero or a NULL arg removes
+ *  the cap.  A cap below the normal delay makes the encoder use only
+ *  short blocks and shortens its transient detection lookahead to fit.
+ *  The short block size is the least delay possible; query the delay
+ *  actually achieved with \ref OV_ECTL_LATENCY_GET.
+ *
+ * Argument: <tt>long *</tt>
+ */
+#define OV_ECTL_LATENCY_SET          0x61
+
+/**
+ *  Returns the current packetblob generation settings for bitrate managed
+ *  encoding.
+ *
+ * Argument: <tt>struct ovectl_packetblobs_arg *</tt>
+*/
+#define OV_ECTL_PACKETBLOBS_GET      0x50
+
+/**
+ *  Sets how bitrate managed encoding generates the candidate encodings of
+ *  each block.  Passing a NULL pointer restores the default of encoding
+ *  all candidates serially.
+ *
+ * Argument: <tt>struct ovectl_packetblobs_arg *</tt>
+ */
+#define OV_ECTL_PACKETBLOBS_SET      0x51
+
+/**
+ *  Returns the current encoder speed setting in the int pointed to by arg.
+ *
+ * Argument: <tt>int *</tt>
+*/
+#define OV_ECTL_SPEED_GET            0x70
+
+/**
+ *  Sets the encoder speed from 0 (the default; the full psychoacoustic
+ *  model) to \ref OV_SPEED_MAX.  Each level skips or simplifies more of
+ *  the analysis for throughput at some cost in quality at a given
+ *  bitrate; the stream remains a normal Vorbis I stream.  A NULL arg
+ *  restores the default.
+ *
+ *  - 1 seeds tone masking from spectral peaks only, skips the fixed
+ *    width noise masking window and, with bitrate management, encodes
+ *    only the candidate blocks the manager looks at.
+ *  - 2 also halves the tone masking resolution, disables noise
+ *    normalization and loosens the floor fit.
+ *  - 3 also estimates tonality from the MDCT rather than a separate FFT
+ *    and runs one transient detector on the mix of all channels.
+ *
+ * Argument: <tt>int *</tt>
+ */
+#define OV_ECTL_SPEED_SET            0x71
+
+/** Highest setting accepted by \ref OV_ECTL_SPEED_SET. */
+#define OV_SPEED_MAX                 3
+
   /* deprecated rate management supported only for compatibility */
 
 /**
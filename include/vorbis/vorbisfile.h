@@ -156,6 +156,18 @@ extern int ov_test(FILE *f,OggVorbis_File *vf,const char *initial,long ibytes);
 extern int ov_test_callbacks(void *datasource, OggVorbis_File *vf,
                 const char *initial, long ibytes, ov_callbacks callbacks);
 extern int ov_test_open(OggVorbis_File *vf);
+extern int ov_clone(OggVorbis_File *vf,void *datasource,OggVorbis_File *clone,
+                ov_callbacks callbacks);
+
+extern int ov_comment_rewrite(void *datasource,ov_callbacks callbacks,
+                vorbis_comment *vc,long padding,
+                size_t (*write_func)(const void *ptr,size_t size,
+                                     size_t nmemb,void *out),
+                void *out);
+extern int ov_comment_rewrite_inplace(void *datasource,ov_callbacks callbacks,
+                vorbis_comment *vc,
+                size_t (*write_func)(const void *ptr,size_t size,
+                                     size_t nmemb,void *datasource));
 
 extern long ov_bitrate(OggVorbis_File *vf,int i);
 extern long ov_bitrate_instant(OggVorbis_File *vf);
@@ -25,6 +25,175 @@
 #include "misc.h"
 #include "bitrate.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+
+/* Workers that encode every packetblob of a managed block at once.
+   Each keeps its own local storage for the residue classifier and its
+   own iwork vectors; the calling thread takes its share of the blobs
+   using the block itself. */
+
+typedef struct {
+  blob_pool *pool;
+  void      *localstore;
+  long       localalloc;
+} blob_worker;
+
+struct blob_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t  wake;   /* a block was handed out, or exit */
+  pthread_cond_t  idle;   /* the last blob of a block finished */
+
+  int             threads;
+  int             started;
+  pthread_t      *thread;
+  blob_worker    *worker;
+
+  int             exit;
+  long            seq;    /* bumped for every block handed out */
+  vorbis_block   *vb;
+  vorbis_block    wb;     /* snapshot of *vb for the workers */
+  int             next;   /* next packetblob to hand out */
+  int             busy;   /* packetblobs being encoded right now */
+  int             ret;
+};
+
+/* wb is a copy of the block taken before the calling thread started
+   allocating from it again */
+static int blob_worker_encode(blob_worker *w,vorbis_block wb,int k){
+  vorbis_block_internal *vbi=wb.internal;
+  vorbis_info *vi=wb.vd->vi;
+  int **iwork;
+  int i,ret;
+
+  wb.localstore=w->localstore;
+  wb.localalloc=w->localalloc;
+  wb.localtop=0;
+  wb.totaluse=0;
+  wb.reap=NULL;
+
+  iwork=_vorbis_block_alloc(&wb,vi->channels*sizeof(*iwork));
+  for(i=0;i<vi->channels;i++)
+    iwork[i]=_vorbis_block_alloc(&wb,wb.pcmend/2*sizeof(**iwork));
+
+  ret=vbi->blob_encode(&wb,k,iwork);
+
+  _vorbis_block_ripcord(&wb);
+  w->localstore=wb.localstore;
+  w->localalloc=wb.localalloc;
+  return(ret);
+}
+
+/* called with the lock held; returns with it held */
+static void blob_pool_drain(blob_pool *p,blob_worker *w){
+  while(p->next<PACKETBLOBS){
+    vorbis_block *vb=p->vb;
+    vorbis_block_internal *vbi=vb->internal;
+    int k=p->next++;
+    int ret;
+
+    p->busy++;
+    pthread_mutex_unlock(&p->lock);
+    if(w)
+      ret=blob_worker_encode(w,p->wb,k);
+    else
+      ret=vbi->blob_encode(vb,k,NULL);
+    pthread_mutex_lock(&p->lock);
+
+    if(ret)p->ret=ret;
+    if(--p->busy==0 && p->next>=PACKETBLOBS)
+      pthread_cond_broadcast(&p->idle);
+  }
+}
+
+static void *blob_pool_thread(void *arg){
+  blob_worker *w=arg;
+  blob_pool *p=w->pool;
+  long seq=0;
+
+  pthread_mutex_lock(&p->lock);
+  while(1){
+    while(!p->exit && p->seq==seq)
+      pthread_cond_wait(&p->wake,&p->lock);
+    if(p->exit)break;
+    seq=p->seq;
+    blob_pool_drain(p,w);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return(NULL);
+}
+
+static void blob_pool_destroy(blob_pool *p){
+  int i;
+
+  pthread_mutex_lock(&p->lock);
+  p->exit=1;
+  pthread_cond_broadcast(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+  for(i=0;i<p->started;i++)
+    pthread_join(p->thread[i],NULL);
+
+  for(i=0;i<p->threads;i++)
+    if(p->worker[i].localstore)_ogg_free(p->worker[i].localstore);
+  pthread_cond_destroy(&p->idle);
+  pthread_cond_destroy(&p->wake);
+  pthread_mutex_destroy(&p->lock);
+  _ogg_free(p->worker);
+  _ogg_free(p->thread);
+  _ogg_free(p);
+}
+
+/* threads counts the calling thread; returns NULL if there's nothing
+   to gain or the workers can't be started */
+static blob_pool *blob_pool_create(int threads){
+  blob_pool *p;
+  int i;
+
+  if(threads>PACKETBLOBS)threads=PACKETBLOBS;
+  if(threads<2)return(NULL);
+
+  p=_ogg_calloc(1,sizeof(*p));
+  p->threads=threads-1;
+  p->thread=_ogg_calloc(p->threads,sizeof(*p->thread));
+  p->worker=_ogg_calloc(p->threads,sizeof(*p->worker));
+  pthread_mutex_init(&p->lock,NULL);
+  pthread_cond_init(&p->wake,NULL);
+  pthread_cond_init(&p->idle,NULL);
+
+  for(i=0;i<p->threads;i++){
+    p->worker[i].pool=p;
+    if(pthread_create(p->thread+i,NULL,blob_pool_thread,p->worker+i))break;
+    p->started++;
+  }
+  if(p->started<p->threads){
+    blob_pool_destroy(p);
+    return(NULL);
+  }
+  return(p);
+}
+
+static int blob_pool_run(blob_pool *p,vorbis_block *vb){
+  int ret;
+
+  pthread_mutex_lock(&p->lock);
+  p->vb=vb;
+  p->wb=*vb;
+  p->next=0;
+  p->ret=0;
+  p->seq++;
+  pthread_cond_broadcast(&p->wake);
+
+  blob_pool_drain(p,NULL);
+  while(p->busy)
+    pthread_cond_wait(&p->idle,&p->lock);
+
+  ret=p->ret;
+  p->vb=NULL;
+  pthread_mutex_unlock(&p->lock);
+  return(ret);
+}
+#endif
+
 /* compute bitrate tracking setup  */
 void vorbis_bitrate_init(vorbis_info *vi,bitrate_manager_state *bm){
   codec_setup_info *ci=vi->codec_setup;
@@ -45,6 +214,15 @@ void vorbis_bitrate_init(vorbis_info *vi,bitrate_manager_state *bm){
 
     bm->avgfloat=PACKETBLOBS/2;
 
+    /* faster encoder speeds are lazy unless asked for threads */
+    if(ci->hi.blobs_lazy || (ci->hi.speed>0 && !ci->hi.blobs_threads)){
+      bm->lazy=1;
+    }else{
+#ifdef HAVE_PTHREAD
+      bm->pool=blob_pool_create(ci->hi.blobs_threads);
+#endif
+    }
+
     /* not a necessary fix, but one that leads to a more balanced
        typical initialization */
     {
@@ -57,6 +235,9 @@ void vorbis_bitrate_init(vorbis_info *vi,bitrate_manager_state *bm){
 }
 
 void vorbis_bitrate_clear(bitrate_manager_state *bm){
+#ifdef HAVE_PTHREAD
+  if(bm->pool)blob_pool_destroy(bm->pool);
+#endif
   memset(bm,0,sizeof(*bm));
   return;
 }
@@ -70,6 +251,41 @@ int vorbis_bitrate_managed(vorbis_block *vb){
   return(0);
 }
 
+/* encode the packetblobs of a managed block; either all of them, on
+   the worker pool if there is one, or none until they're asked for */
+int vorbis_bitrate_blobs(vorbis_block *vb){
+  vorbis_block_internal *vbi=vb->internal;
+  private_state         *b=vb->vd->backend_state;
+  bitrate_manager_state *bm=&b->bms;
+  int k,ret;
+
+  if(bm->lazy){
+    vbi->blobs_pending=(1<<PACKETBLOBS)-1;
+    return(0);
+  }
+
+#ifdef HAVE_PTHREAD
+  if(bm->pool)
+    return(blob_pool_run(bm->pool,vb));
+#endif
+
+  for(k=0;k<PACKETBLOBS;k++)
+    if((ret=vbi->blob_encode(vb,k,NULL)))
+      return(ret);
+  return(0);
+}
+
+/* size in bits of a packetblob, encoding it first if it's pending */
+static long blob_bits(vorbis_block *vb,int k){
+  vorbis_block_internal *vbi=vb->internal;
+
+  if(vbi->blobs_pending&(1<<k)){
+    vbi->blobs_pending&=~(1<<k);
+    vbi->blob_encode(vb,k,NULL);
+  }
+  return(oggpack_bytes(vbi->packetblob[k])*8);
+}
+
 /* finish taking in the block we just processed */
 int vorbis_bitrate_addblock(vorbis_block *vb){
   vorbis_block_internal *vbi=vb->internal;
@@ -81,7 +297,7 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
   bitrate_manager_info  *bi=&ci->bi;
 
   int  choice=rint(bm->avgfloat);
-  long this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+  long this_bits;
   long min_target_bits=(vb->W?bm->min_bitsper*bm->short_per_long:bm->min_bitsper);
   long max_target_bits=(vb->W?bm->max_bitsper*bm->short_per_long:bm->max_bitsper);
   int  samples=ci->blocksizes[vb->W]>>1;
@@ -97,6 +313,7 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
   }
 
   bm->vb=vb;
+  this_bits=blob_bits(vb,choice);
 
   /* look ahead for avg floater */
   if(bm->avg_bitsper>0){
@@ -119,13 +336,13 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
       while(choice>0 && this_bits>avg_target_bits &&
             bm->avg_reservoir+(this_bits-avg_target_bits)>desired_fill){
         choice--;
-        this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+        this_bits=blob_bits(vb,choice);
       }
     }else if(bm->avg_reservoir+(this_bits-avg_target_bits)<desired_fill){
       while(choice+1<PACKETBLOBS && this_bits<avg_target_bits &&
             bm->avg_reservoir+(this_bits-avg_target_bits)<desired_fill){
         choice++;
-        this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+        this_bits=blob_bits(vb,choice);
       }
     }
 
@@ -133,7 +350,7 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
     if(slew<-slewlimit)slew=-slewlimit;
     if(slew>slewlimit)slew=slewlimit;
     choice=rint(bm->avgfloat+= slew/vi->rate*samples);
-    this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+    this_bits=blob_bits(vb,choice);
   }
 
 
@@ -145,7 +362,7 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
       while(bm->minmax_reservoir-(min_target_bits-this_bits)<0){
         choice++;
         if(choice>=PACKETBLOBS)break;
-        this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+        this_bits=blob_bits(vb,choice);
       }
     }
   }
@@ -157,7 +374,7 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
       while(bm->minmax_reservoir+(this_bits-max_target_bits)>bi->reservoir_bits){
         choice--;
         if(choice<0)break;
-        this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+        this_bits=blob_bits(vb,choice);
       }
     }
   }
@@ -171,10 +388,10 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
     long maxsize=(max_target_bits+(bi->reservoir_bits-bm->minmax_reservoir))/8;
     bm->choice=choice=0;
 
-    if(oggpack_bytes(vbi->packetblob[choice])>maxsize){
+    if(blob_bits(vb,choice)/8>maxsize){
 
       oggpack_writetrunc(vbi->packetblob[choice],maxsize*8);
-      this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+      this_bits=blob_bits(vb,choice);
     }
   }else{
     long minsize=(min_target_bits-bm->minmax_reservoir+7)/8;
@@ -184,9 +401,9 @@ int vorbis_bitrate_addblock(vorbis_block *vb){
     bm->choice=choice;
 
     /* prop up bitrate according to demand. pad this frame out with zeroes */
-    minsize-=oggpack_bytes(vbi->packetblob[choice]);
+    minsize-=blob_bits(vb,choice)/8;
     while(minsize-->0)oggpack_write(vbi->packetblob[choice],0,8);
-    this_bits=oggpack_bytes(vbi->packetblob[choice])*8;
+    this_bits=blob_bits(vb,choice);
 
   }
 
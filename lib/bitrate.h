@@ -23,6 +23,8 @@
 #include "os.h"
 
 /* encode side bitrate tracking */
+typedef struct blob_pool blob_pool;
+
 typedef struct bitrate_manager_state {
   int            managed;
 
@@ -37,6 +39,9 @@ typedef struct bitrate_manager_state {
 
   vorbis_block  *vb;
   int            choice;
+
+  int            lazy;   /* packetblobs encoded only as they're probed */
+  blob_pool     *pool;   /* workers encoding all packetblobs at once */
 } bitrate_manager_state;
 
 typedef struct bitrate_manager_info{
@@ -53,6 +58,7 @@ typedef struct bitrate_manager_info{
 extern void vorbis_bitrate_init(vorbis_info *vi,bitrate_manager_state *bs);
 extern void vorbis_bitrate_clear(bitrate_manager_state *bs);
 extern int vorbis_bitrate_managed(vorbis_block *vb);
+extern int vorbis_bitrate_blobs(vorbis_block *vb);
 extern int vorbis_bitrate_addblock(vorbis_block *vb);
 extern int vorbis_bitrate_flushpacket(vorbis_dsp_state *vd, ogg_packet *op);
 
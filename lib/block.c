@@ -30,6 +30,7 @@
 #include "lpc.h"
 #include "registry.h"
 #include "misc.h"
+#include "os.h"
 
 static int ilog2(unsigned int v){
   int ret=0;
@@ -85,12 +86,41 @@ static int ilog2(unsigned int v){
 #define WORD_ALIGN 8
 #endif
 
+/* what one block of this stream takes from its local storage, with
+   some headroom, so that steady state encode and decode never have to
+   grow it */
+static long _vorbis_block_storage(vorbis_dsp_state *v){
+  vorbis_info *vi=v->vi;
+  codec_setup_info *ci=vi->codec_setup;
+  private_state *b=v->backend_state;
+  long n=ci->blocksizes[1];
+  long bytes;
+
+  if(!v->analysisp){
+    /* the pcm, plus floor and residue decode state */
+    bytes=vi->channels*n*sizeof(float);
+  }else{
+    /* per channel, the delayed pcm and four half-block vectors
+       (spectra, working mdct, quantized residue); the masking
+       vectors shared by all channels */
+    bytes=vi->channels*(n*3/2+n*2)*sizeof(float)+n*3/2*sizeof(float);
+    /* each packetblob's residue coding needs its own work vectors */
+    if(b->bms.managed)
+      bytes+=PACKETBLOBS*vi->channels*n/2*sizeof(int);
+  }
+  return bytes+bytes/4;
+}
+
 int vorbis_block_init(vorbis_dsp_state *v, vorbis_block *vb){
   int i;
   memset(vb,0,sizeof(*vb));
   vb->vd=v;
   vb->localalloc=0;
   vb->localstore=NULL;
+  if(v->vi && v->backend_state){
+    vb->localalloc=_vorbis_block_storage(v);
+    vb->localstore=_ogg_malloc(vb->localalloc);
+  }
   if(v->analysisp){
     vorbis_block_internal *vbi=
       vb->internal=_ogg_calloc(1,sizeof(vorbis_block_internal));
@@ -178,6 +208,44 @@ int vorbis_block_clear(vorbis_block *vb){
    here and not in analysis.c (which is for analysis transforms only).
    The init is here because some of it is shared */
 
+/* the analysis ring holds the most blockout can need before it gives
+   up a block (two long blocks plus the envelope lookahead), a long
+   block of room for direct writes, and the three long blocks of
+   extrapolation added at end of stream */
+static long _pcm_ring_size(codec_setup_info *ci){
+  return ci->blocksizes[1]*6+(VE_WIN+VE_POST+2)*VE_STEP;
+}
+
+/* how far writes may fill the ring; the rest is kept for eof */
+static long _pcm_ring_fill(vorbis_dsp_state *v){
+  codec_setup_info *ci=v->vi->codec_setup;
+  return v->pcm_storage-ci->blocksizes[1]*3;
+}
+
+/* copy samples [from,to) of the current window to their twin half of
+   the ring */
+static void _pcm_ring_mirror(vorbis_dsp_state *v,long from,long to){
+  private_state *b=v->backend_state;
+  long cap=v->pcm_storage;
+  long pos=b->pcm_ringpos+from;
+  int i;
+
+  while(from<to){
+    long n=to-from;
+    long twin;
+    if(pos<cap){
+      if(n>cap-pos)n=cap-pos;
+      twin=pos+cap;
+    }else
+      twin=pos-cap;
+
+    for(i=0;i<v->vi->channels;i++)
+      memcpy(b->pcm_ring[i]+twin,b->pcm_ring[i]+pos,n*sizeof(**b->pcm_ring));
+    from+=n;
+    pos+=n;
+  }
+}
+
 static int _vds_shared_init(vorbis_dsp_state *v,vorbis_info *vi,int encp){
   int i;
   codec_setup_info *ci=vi->codec_setup;
@@ -232,27 +300,24 @@ static int _vds_shared_init(vorbis_dsp_state *v,vorbis_info *vi,int encp){
     v->analysisp=1;
   }else{
     /* finish the codebooks */
-    if(!ci->fullbooks){
-      ci->fullbooks=_ogg_calloc(ci->books,sizeof(*ci->fullbooks));
-      for(i=0;i<ci->books;i++){
-        if(ci->book_param[i]==NULL)
-          goto abort_books;
-        if(vorbis_book_init_decode(ci->fullbooks+i,ci->book_param[i]))
-          goto abort_books;
-        /* decode codebooks are now standalone after init */
-        vorbis_staticbook_destroy(ci->book_param[i]);
-        ci->book_param[i]=NULL;
-      }
-    }
+    if(_vi_decode_books(vi))
+      goto abort_books;
   }
 
-  /* initialize the storage vectors. blocksize[1] is small for encode,
-     but the correct size for decode */
-  v->pcm_storage=ci->blocksizes[1];
+  /* initialize the storage vectors. blocksize[1] is the correct size
+     for decode; encode uses a fixed ring (see
+     vorbis_analysis_buffer()) */
   v->pcm=_ogg_malloc(vi->channels*sizeof(*v->pcm));
   v->pcmret=_ogg_malloc(vi->channels*sizeof(*v->pcmret));
-  {
-    int i;
+  if(encp){
+    v->pcm_storage=_pcm_ring_size(ci);
+    b->pcm_ring=_ogg_malloc(vi->channels*sizeof(*b->pcm_ring));
+    b->pcm_stage=_ogg_calloc(vi->channels,sizeof(*b->pcm_stage));
+    for(i=0;i<vi->channels;i++)
+      v->pcm[i]=b->pcm_ring[i]=
+        _ogg_calloc(v->pcm_storage*2,sizeof(*v->pcm[i]));
+  }else{
+    v->pcm_storage=ci->blocksizes[1];
     for(i=0;i<vi->channels;i++)
       v->pcm[i]=_ogg_calloc(v->pcm_storage,sizeof(*v->pcm[i]));
   }
@@ -281,12 +346,6 @@ static int _vds_shared_init(vorbis_dsp_state *v,vorbis_info *vi,int encp){
 
   return 0;
  abort_books:
-  for(i=0;i<ci->books;i++){
-    if(ci->book_param[i]!=NULL){
-      vorbis_staticbook_destroy(ci->book_param[i]);
-      ci->book_param[i]=NULL;
-    }
-  }
   vorbis_dsp_clear(v);
   return -1;
 }
@@ -366,6 +425,18 @@ void vorbis_dsp_clear(vorbis_dsp_state *v){
 
     }
 
+    if(b && b->pcm_ring){
+      /* analysis; pcm[] points into the ring */
+      if(vi)
+        for(i=0;i<vi->channels;i++){
+          if(b->pcm_ring[i])_ogg_free(b->pcm_ring[i]);
+          if(b->pcm_stage && b->pcm_stage[i])_ogg_free(b->pcm_stage[i]);
+          if(v->pcm)v->pcm[i]=NULL;
+        }
+      _ogg_free(b->pcm_ring);
+      if(b->pcm_stage)_ogg_free(b->pcm_stage);
+    }
+
     if(v->pcm){
       if(vi)
         for(i=0;i<vi->channels;i++)
@@ -396,129 +467,327 @@ float **vorbis_analysis_buffer(vorbis_dsp_state *v, int vals){
   if(b->header1)_ogg_free(b->header1);b->header1=NULL;
   if(b->header2)_ogg_free(b->header2);b->header2=NULL;
 
-  /* Do we have enough storage space for the requested buffer? If not,
-     expand the PCM (and envelope) storage */
+  /* Small writes go straight into the ring.  Anything that does not
+     fit behind what is already there (or would overtake samples still
+     waiting in the stage) goes to the stage, which only grows when an
+     application asks for more at once than it ever has before. */
+  b->pcm_staged=0;
+  if(b->pcm_stagehead<b->pcm_stagetail ||
+     v->pcm_current+vals>_pcm_ring_fill(v)){
 
-  if(v->pcm_current+vals>=v->pcm_storage){
-    v->pcm_storage=v->pcm_current+vals*2;
+    if(b->pcm_stagehead==b->pcm_stagetail)
+      b->pcm_stagehead=b->pcm_stagetail=0;
 
-    for(i=0;i<vi->channels;i++){
-      v->pcm[i]=_ogg_realloc(v->pcm[i],v->pcm_storage*sizeof(*v->pcm[i]));
+    if(b->pcm_stagetail+vals>b->pcm_stagesize){
+      long pending=b->pcm_stagetail-b->pcm_stagehead;
+      if(b->pcm_stagehead){
+        for(i=0;i<vi->channels;i++)
+          memmove(b->pcm_stage[i],b->pcm_stage[i]+b->pcm_stagehead,
+                  pending*sizeof(*b->pcm_stage[i]));
+        b->pcm_stagehead=0;
+        b->pcm_stagetail=pending;
+      }
+      if(pending+vals>b->pcm_stagesize){
+        b->pcm_stagesize=pending+vals;
+        for(i=0;i<vi->channels;i++)
+          b->pcm_stage[i]=_ogg_realloc(b->pcm_stage[i],b->pcm_stagesize*
+                                       sizeof(*b->pcm_stage[i]));
+      }
     }
-  }
 
-  for(i=0;i<vi->channels;i++)
-    v->pcmret[i]=v->pcm[i]+v->pcm_current;
+    b->pcm_staged=1;
+    for(i=0;i<vi->channels;i++)
+      v->pcmret[i]=b->pcm_stage[i]+b->pcm_stagetail;
+  }else{
+    for(i=0;i<vi->channels;i++)
+      v->pcmret[i]=v->pcm[i]+v->pcm_current;
+  }
 
   return(v->pcmret);
 }
 
 static void _preextrapolate_helper(vorbis_dsp_state *v){
+  codec_setup_info *ci=v->vi->codec_setup;
   int i;
   int order=16;
   float *lpc=alloca(order*sizeof(*lpc));
-  float *work=alloca(v->pcm_current*sizeof(*work));
+  float *work;
   long j;
   v->preextrapolate=1;
 
   if(v->pcm_current-v->centerW>order*2){ /* safety */
+    /* a long block of the stream's opening is plenty to fit the
+       predictor to, however much has been buffered */
+    long span=v->pcm_current-v->centerW;
+    if(span>ci->blocksizes[1])span=ci->blocksizes[1];
+
+    work=_ogg_malloc((span+v->centerW)*sizeof(*work));
     for(i=0;i<v->vi->channels;i++){
       /* need to run the extrapolation in reverse! */
-      for(j=0;j<v->pcm_current;j++)
-        work[j]=v->pcm[i][v->pcm_current-j-1];
+      for(j=0;j<span;j++)
+        work[j]=v->pcm[i][v->centerW+span-j-1];
 
       /* prime as above */
-      vorbis_lpc_from_data(work,lpc,v->pcm_current-v->centerW,order);
+      vorbis_lpc_from_data(work,lpc,span,order);
 
 #if 0
       if(v->vi->channels==2){
         if(i==0)
-          _analysis_output("predataL",0,work,v->pcm_current-v->centerW,0,0,0);
+          _analysis_output("predataL",0,work,span,0,0,0);
         else
-          _analysis_output("predataR",0,work,v->pcm_current-v->centerW,0,0,0);
+          _analysis_output("predataR",0,work,span,0,0,0);
       }else{
-        _analysis_output("predata",0,work,v->pcm_current-v->centerW,0,0,0);
+        _analysis_output("predata",0,work,span,0,0,0);
       }
 #endif
 
       /* run the predictor filter */
-      vorbis_lpc_predict(lpc,work+v->pcm_current-v->centerW-order,
+      vorbis_lpc_predict(lpc,work+span-order,
                          order,
-                         work+v->pcm_current-v->centerW,
+                         work+span,
                          v->centerW);
 
-      for(j=0;j<v->pcm_current;j++)
-        v->pcm[i][v->pcm_current-j-1]=work[j];
+      for(j=0;j<v->centerW;j++)
+        v->pcm[i][v->centerW-j-1]=work[span+j];
 
     }
+    _ogg_free(work);
+    _pcm_ring_mirror(v,0,v->centerW);
   }
 }
 
 
+/* the end of the stream; the ring always has room for this */
+static void _analysis_eof(vorbis_dsp_state *v){
+  vorbis_info *vi=v->vi;
+  codec_setup_info *ci=vi->codec_setup;
+  int order=32;
+  int i;
+  float *lpc=alloca(order*sizeof(*lpc));
+
+  /* if it wasn't done earlier (very short sample) */
+  if(!v->preextrapolate)
+    _preextrapolate_helper(v);
+
+  /* We're encoding the end of the stream.  Just make sure we have
+     [at least] a few full blocks of zeroes at the end. */
+  /* actually, we don't want zeroes; that could drop a large
+     amplitude off a cliff, creating spread spectrum noise that will
+     suck to encode.  Extrapolate for the sake of cleanliness. */
+
+  v->eofflag=v->pcm_current;
+  v->pcm_current+=ci->blocksizes[1]*3;
+
+  for(i=0;i<vi->channels;i++){
+    if(v->eofflag>order*2){
+      /* extrapolate with LPC to fill in */
+      long n;
+
+      /* make a predictor filter */
+      n=v->eofflag;
+      if(n>ci->blocksizes[1])n=ci->blocksizes[1];
+      vorbis_lpc_from_data(v->pcm[i]+v->eofflag-n,lpc,n,order);
+
+      /* run the predictor filter */
+      vorbis_lpc_predict(lpc,v->pcm[i]+v->eofflag-order,order,
+                         v->pcm[i]+v->eofflag,v->pcm_current-v->eofflag);
+    }else{
+      /* not enough data to extrapolate (unlikely to happen due to
+         guarding the overlap, but bulletproof in case that
+         assumtion goes away). zeroes will do. */
+      memset(v->pcm[i]+v->eofflag,0,
+             (v->pcm_current-v->eofflag)*sizeof(*v->pcm[i]));
+
+    }
+  }
+  _pcm_ring_mirror(v,v->eofflag,v->pcm_current);
+}
+
+/* account for vals new samples written at the end of the ring */
+static void _analysis_commit(vorbis_dsp_state *v,long vals){
+  codec_setup_info *ci=v->vi->codec_setup;
+  private_state *b=v->backend_state;
+
+  _pcm_ring_mirror(v,v->pcm_current,v->pcm_current+vals);
+  v->pcm_current+=vals;
+
+  /* we may want to reverse extrapolate the beginning of a stream
+     too... in case we're beginning on a cliff! */
+  /* clumsy, but simple.  It only runs once, so simple is good. */
+  /* (a low delay encoder starts once it has a short block) */
+  if(!v->preextrapolate &&
+     (b->ve->lookahead>=0?
+      v->pcm_current-v->centerW>=ci->blocksizes[0]:
+      v->pcm_current-v->centerW>ci->blocksizes[1]))
+    _preextrapolate_helper(v);
+}
+
+/* move as much staged input into the ring as fits */
+static void _analysis_refill(vorbis_dsp_state *v){
+  private_state *b=v->backend_state;
+  long n=b->pcm_stagetail-b->pcm_stagehead;
+  int i;
+
+  if(n>0){
+    long room=_pcm_ring_fill(v)-v->pcm_current;
+    if(n>room)n=room;
+    if(n>0){
+      for(i=0;i<v->vi->channels;i++)
+        memcpy(v->pcm[i]+v->pcm_current,b->pcm_stage[i]+b->pcm_stagehead,
+               n*sizeof(*v->pcm[i]));
+      b->pcm_stagehead+=n;
+      _analysis_commit(v,n);
+    }
+  }
+
+  if(b->pcm_stagehead==b->pcm_stagetail){
+    b->pcm_stagehead=b->pcm_stagetail=0;
+    if(b->pcm_eof){
+      b->pcm_eof=0;
+      _analysis_eof(v);
+    }
+  }
+}
+
 /* call with val<=0 to set eof */
 
 int vorbis_analysis_wrote(vorbis_dsp_state *v, int vals){
-  vorbis_info *vi=v->vi;
-  codec_setup_info *ci=vi->codec_setup;
+  private_state *b=v->backend_state;
 
   if(vals<=0){
-    int order=32;
-    int i;
-    float *lpc=alloca(order*sizeof(*lpc));
-
-    /* if it wasn't done earlier (very short sample) */
-    if(!v->preextrapolate)
-      _preextrapolate_helper(v);
-
-    /* We're encoding the end of the stream.  Just make sure we have
-       [at least] a few full blocks of zeroes at the end. */
-    /* actually, we don't want zeroes; that could drop a large
-       amplitude off a cliff, creating spread spectrum noise that will
-       suck to encode.  Extrapolate for the sake of cleanliness. */
-
-    vorbis_analysis_buffer(v,ci->blocksizes[1]*3);
-    v->eofflag=v->pcm_current;
-    v->pcm_current+=ci->blocksizes[1]*3;
-
-    for(i=0;i<vi->channels;i++){
-      if(v->eofflag>order*2){
-        /* extrapolate with LPC to fill in */
-        long n;
-
-        /* make a predictor filter */
-        n=v->eofflag;
-        if(n>ci->blocksizes[1])n=ci->blocksizes[1];
-        vorbis_lpc_from_data(v->pcm[i]+v->eofflag-n,lpc,n,order);
-
-        /* run the predictor filter */
-        vorbis_lpc_predict(lpc,v->pcm[i]+v->eofflag-order,order,
-                           v->pcm[i]+v->eofflag,v->pcm_current-v->eofflag);
-      }else{
-        /* not enough data to extrapolate (unlikely to happen due to
-           guarding the overlap, but bulletproof in case that
-           assumtion goes away). zeroes will do. */
-        memset(v->pcm[i]+v->eofflag,0,
-               (v->pcm_current-v->eofflag)*sizeof(*v->pcm[i]));
+    /* the stream ends after whatever is still staged */
+    if(b->pcm_stagehead<b->pcm_stagetail)
+      b->pcm_eof=1;
+    else
+      _analysis_eof(v);
+  }else if(b->pcm_staged){
+
+    if(b->pcm_stagetail+vals>b->pcm_stagesize)
+      return(OV_EINVAL);
+
+    b->pcm_stagetail+=vals;
+    _analysis_refill(v);
 
-      }
-    }
   }else{
 
-    if(v->pcm_current+vals>v->pcm_storage)
+    if(v->pcm_current+vals>_pcm_ring_fill(v))
       return(OV_EINVAL);
 
-    v->pcm_current+=vals;
-
-    /* we may want to reverse extrapolate the beginning of a stream
-       too... in case we're beginning on a cliff! */
-    /* clumsy, but simple.  It only runs once, so simple is good. */
-    if(!v->preextrapolate && v->pcm_current-v->centerW>ci->blocksizes[1])
-      _preextrapolate_helper(v);
+    _analysis_commit(v,vals);
 
   }
   return(0);
 }
 
+/* Interleaved input.  These convert and deinterleave straight into
+   the planes vorbis_analysis_buffer() hands out, then commit them as
+   vorbis_analysis_wrote() would.  Mono and stereo, the usual cases,
+   go four frames at a time where SSE2 is available. */
+
+int vorbis_analysis_write_interleaved_f32(vorbis_dsp_state *v,
+                                          const float *pcm,int samples){
+  int ch=v->vi->channels;
+  float **buf;
+  long i=0;
+  int j;
+
+  if(samples<0)return(OV_EINVAL);
+  if(samples==0)return(0);
+  buf=vorbis_analysis_buffer(v,samples);
+
+  if(ch==1){
+    memcpy(buf[0],pcm,samples*sizeof(*pcm));
+    i=samples;
+  }
+#ifdef VORBIS_SSE2
+  else if(ch==2){
+    float *l=buf[0],*r=buf[1];
+    for(;i+4<=samples;i+=4){
+      __m128 a=_mm_loadu_ps(pcm+i*2);
+      __m128 b=_mm_loadu_ps(pcm+i*2+4);
+      _mm_storeu_ps(l+i,_mm_shuffle_ps(a,b,_MM_SHUFFLE(2,0,2,0)));
+      _mm_storeu_ps(r+i,_mm_shuffle_ps(a,b,_MM_SHUFFLE(3,1,3,1)));
+    }
+  }
+#endif
+
+  for(;i<samples;i++)
+    for(j=0;j<ch;j++)
+      buf[j][i]=pcm[i*ch+j];
+
+  return(vorbis_analysis_wrote(v,samples));
+}
+
+/* native endian 16 bit; the same scale as encoder_example */
+int vorbis_analysis_write_interleaved_s16(vorbis_dsp_state *v,
+                                          const ogg_int16_t *pcm,
+                                          int samples){
+  int ch=v->vi->channels;
+  float **buf;
+  long i=0;
+  int j;
+
+  if(samples<0)return(OV_EINVAL);
+  if(samples==0)return(0);
+  buf=vorbis_analysis_buffer(v,samples);
+
+#ifdef VORBIS_SSE2
+  if(ch<=2){
+    /* widen with sign by unpacking into the high half and shifting
+       back down; 1/32768 is exact, so this matches the scalar
+       divide.  Eight samples per pass: eight mono frames or four
+       stereo frames. */
+    const __m128 scale=_mm_set1_ps(1.f/32768.f);
+    long step=8/ch;
+    for(;i+step<=samples;i+=step){
+      __m128i x=_mm_loadu_si128((const __m128i *)(pcm+i*ch));
+      __m128 a=_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(
+                            _mm_unpacklo_epi16(x,x),16)),scale);
+      __m128 b=_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(
+                            _mm_unpackhi_epi16(x,x),16)),scale);
+      if(ch==1){
+        _mm_storeu_ps(buf[0]+i,a);
+        _mm_storeu_ps(buf[0]+i+4,b);
+      }else{
+        _mm_storeu_ps(buf[0]+i,_mm_shuffle_ps(a,b,_MM_SHUFFLE(2,0,2,0)));
+        _mm_storeu_ps(buf[1]+i,_mm_shuffle_ps(a,b,_MM_SHUFFLE(3,1,3,1)));
+      }
+    }
+  }
+#endif
+
+  for(;i<samples;i++)
+    for(j=0;j<ch;j++)
+      buf[j][i]=pcm[i*ch+j]/32768.f;
+
+  return(vorbis_analysis_wrote(v,samples));
+}
+
+/* packed little endian 24 bit, three bytes per sample */
+int vorbis_analysis_write_interleaved_s24(vorbis_dsp_state *v,
+                                          const unsigned char *pcm,
+                                          int samples){
+  int ch=v->vi->channels;
+  float **buf;
+  long i;
+  int j;
+
+  if(samples<0)return(OV_EINVAL);
+  if(samples==0)return(0);
+  buf=vorbis_analysis_buffer(v,samples);
+
+  for(i=0;i<samples;i++)
+    for(j=0;j<ch;j++,pcm+=3){
+      /* assemble in the top 24 bits, then shift down with sign */
+      ogg_int32_t x=(ogg_int32_t)(((ogg_uint32_t)pcm[0]<<8)|
+                                  ((ogg_uint32_t)pcm[1]<<16)|
+                                  ((ogg_uint32_t)pcm[2]<<24));
+      buf[j][i]=(x>>8)/8388608.f;
+    }
+
+  return(vorbis_analysis_wrote(v,samples));
+}
+
 /* do the deltas, envelope shaping, pre-echo and determine the size of
    the next block on which to continue analysis */
 int vorbis_analysis_blockout(vorbis_dsp_state *v,vorbis_block *vb){
@@ -530,6 +799,9 @@ int vorbis_analysis_blockout(vorbis_dsp_state *v,vorbis_block *vb){
   long beginW=v->centerW-ci->blocksizes[v->W]/2,centerNext;
   vorbis_block_internal *vbi=(vorbis_block_internal *)vb->internal;
 
+  /* take up any input that was too large for the ring */
+  _analysis_refill(v);
+
   /* check to see if we're started... */
   if(!v->preextrapolate)return(0);
 
@@ -543,7 +815,12 @@ int vorbis_analysis_blockout(vorbis_dsp_state *v,vorbis_block *vb){
   /* we do an envelope search even on a single blocksize; we may still
      be throwing more bits at impulses, and envelope search handles
      marking impulses too. */
-  {
+  if(b->ve->lookahead>=0){
+    /* low delay; short blocks only, so there's no next block size to
+       wait on.  Search anyway for the impulse marks. */
+    _ve_envelope_search(v);
+    v->nW=0;
+  }else{
     long bp=_ve_envelope_search(v);
     if(bp==-1){
 
@@ -565,6 +842,8 @@ int vorbis_analysis_blockout(vorbis_dsp_state *v,vorbis_block *vb){
     /* center of next block + next block maximum right side. */
 
     long blockbound=centerNext+ci->blocksizes[v->nW]/2;
+    if(b->ve->lookahead>=0) /* low delay; the block and its lookahead */
+      blockbound=v->centerW+ci->blocksizes[v->W]/2+b->ve->lookahead;
     if(v->pcm_current<blockbound)return(0); /* not enough data yet;
                                                although this check is
                                                less strict that the
@@ -580,6 +859,7 @@ int vorbis_analysis_blockout(vorbis_dsp_state *v,vorbis_block *vb){
      regardless of actual settings in the stream */
 
   _vorbis_block_ripcord(vb);
+  vbi->spectrum=NULL;
   vb->lW=v->lW;
   vb->W=v->W;
   vb->nW=v->nW;
@@ -654,10 +934,12 @@ int vorbis_analysis_blockout(vorbis_dsp_state *v,vorbis_block *vb){
       _ve_envelope_shift(b->ve,movementW);
       v->pcm_current-=movementW;
 
+      /* the window slides along the ring; both copies of what it
+         still covers are current, so nothing moves */
+      b->pcm_ringpos+=movementW;
+      if(b->pcm_ringpos>=v->pcm_storage)b->pcm_ringpos-=v->pcm_storage;
       for(i=0;i<vi->channels;i++)
-        memmove(v->pcm[i],v->pcm[i]+movementW,
-                v->pcm_current*sizeof(*v->pcm[i]));
-
+        v->pcm[i]=b->pcm_ring[i]+b->pcm_ringpos;
 
       v->lW=v->W;
       v->W=v->nW;
@@ -682,6 +964,64 @@ int vorbis_analysis_blockout(vorbis_dsp_state *v,vorbis_block *vb){
   return(1);
 }
 
+/* Takes the next block of an encoder that follows another's block
+   decisions rather than making its own.  The follower is fed no PCM;
+   each of its blocks takes the boundaries, block type and signal
+   analysis (transforms and log spectra) of the leader's block, which
+   must already have been through vorbis_analysis().  Only the
+   psychoacoustics, floor fit and residue coding are done again by the
+   follower, against its own setup, so one analysis serves several
+   quality levels.  Both encoders must use the same sample rate,
+   channel count and block sizes.  The leader's block must not be taken out again until
+   the follower's block is analyzed. */
+int vorbis_analysis_blockout_follow(vorbis_dsp_state *v,vorbis_block *vb,
+                                    vorbis_block *lead){
+  vorbis_info *vi=v->vi;
+  codec_setup_info *ci=vi->codec_setup;
+  private_state *b=v->backend_state;
+  vorbis_block_internal *vbi=(vorbis_block_internal *)vb->internal;
+  vorbis_block_internal *lbi=(vorbis_block_internal *)lead->internal;
+  vorbis_info *li;
+  codec_setup_info *lci;
+  vorbis_look_psy_global *g;
+
+  if(!b || !v->analysisp || !lead->vd || !lbi || !lbi->spectrum)
+    return(OV_EINVAL);
+  li=lead->vd->vi;
+  lci=li->codec_setup;
+  if(vi->rate!=li->rate ||
+     vi->channels!=li->channels ||
+     ci->blocksizes[0]!=lci->blocksizes[0] ||
+     ci->blocksizes[1]!=lci->blocksizes[1])
+    return(OV_EINVAL);
+
+  /* check to see if we're done... */
+  if(v->eofflag==-1)return(0);
+
+  _vorbis_block_ripcord(vb);
+  vbi->spectrum=lbi->spectrum;
+  vbi->blocktype=lbi->blocktype;
+  vb->lW=v->lW=lead->lW;
+  vb->W=v->W=lead->W;
+  vb->nW=v->nW=lead->nW;
+
+  vb->vd=v;
+  vb->sequence=v->sequence++;
+  vb->granulepos=v->granulepos=lead->granulepos;
+  vb->pcmend=lead->pcmend;
+  vb->pcm=lead->pcm;
+  vb->eofflag=lead->eofflag;
+  if(vb->eofflag)v->eofflag=-1;
+
+  /* the follower's own peak tracking */
+  g=b->psy_g_look;
+  if(vbi->ampmax>g->ampmax)g->ampmax=vbi->ampmax;
+  g->ampmax=_vp_ampmax_decay(g->ampmax,v);
+  vbi->ampmax=g->ampmax;
+
+  return(1);
+}
+
 int vorbis_synthesis_restart(vorbis_dsp_state *v){
   vorbis_info *vi=v->vi;
   codec_setup_info *ci;
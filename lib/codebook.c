@@ -272,9 +272,40 @@ static_codebook *vorbis_staticbook_unpack(oggpack_buffer *opb){
 
 /* returns the number of bits ************************************************/
 int vorbis_book_encode(codebook *book, int a, oggpack_buffer *b){
-  if(a<0 || a>=book->c->entries)return(0);
-  oggpack_write(b,book->codelist[a],book->c->lengthlist[a]);
-  return(book->c->lengthlist[a]);
+  const codebook_word *w;
+  if(a<0 || a>=book->entries)return(0);
+  w=book->enc_words+a;
+  oggpack_write(b,w->word,w->length);
+  return(w->length);
+}
+
+/* encodes a run of n entries; codewords are gathered into whole
+   32 bit words before they are handed to the packer */
+int vorbis_book_encodev(codebook *book, const int *a, int n,
+                        oggpack_buffer *b){
+  const codebook_word *words=book->enc_words;
+  long entries=book->entries;
+  ogg_uint32_t acc=0;
+  int i,accbits=0,bits=0;
+
+  for(i=0;i<n;i++){
+    const codebook_word *w;
+    if(a[i]<0 || a[i]>=entries)continue;
+    w=words+a[i];
+    if(!w->length)continue;
+
+    if(accbits+w->length>32){
+      oggpack_write(b,acc,accbits);
+      acc=0;
+      accbits=0;
+    }
+    acc|=w->word<<accbits;
+    accbits+=w->length;
+    bits+=w->length;
+  }
+  if(accbits)oggpack_write(b,acc,accbits);
+
+  return(bits);
 }
 
 /* the 'eliminate the decode tree' optimization actually requires the
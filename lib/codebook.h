@@ -55,17 +55,23 @@ typedef struct static_codebook{
   int allocedp;
 } static_codebook;
 
+/* encode only; an entry's codeword and length side by side */
+typedef struct codebook_word{
+  ogg_uint32_t word;
+  int          length;
+} codebook_word;
+
 typedef struct codebook{
   long dim;           /* codebook dimensions (elements per vector) */
   long entries;       /* codebook entries */
   long used_entries;  /* populated codebook entries */
   const static_codebook *c;
 
-  /* for encode, the below are entry-ordered, fully populated */
-  /* for decode, the below are ordered by bitreversed codeword and only
-     used entries are populated */
-  float        *valuelist;  /* list of dim*entries actual entry values */
-  ogg_uint32_t *codelist;   /* list of bitstream codewords for each entry */
+  /* decode only (encode uses enc_words and enc_vals below); ordered
+     by bitreversed codeword and only used entries are populated */
+  float        *valuelist;  /* list of dim*used_entries entry values */
+  ogg_uint32_t *codelist;   /* list of bitstream codewords, one per used
+                               entry */
 
   int          *dec_index;  /* only used if sparseness collapsed */
   char         *dec_codelengths;
@@ -77,6 +83,15 @@ typedef struct codebook{
   int           quantvals;
   int           minval;
   int           delta;
+
+  /* encode only; value vectors and entry numbers of the populated
+     entries of a sparse lattice book, in entry order */
+  int          *enc_vals;
+  int          *enc_index;
+  long          enc_used;
+
+  /* encode only; codeword and length of every entry, in entry order */
+  codebook_word *enc_words;
 } codebook;
 
 extern void vorbis_staticbook_destroy(static_codebook *b);
@@ -102,6 +117,8 @@ extern int vorbis_staticbook_pack(const static_codebook *c,oggpack_buffer *b);
 extern static_codebook *vorbis_staticbook_unpack(oggpack_buffer *b);
 
 extern int vorbis_book_encode(codebook *book, int a, oggpack_buffer *b);
+extern int vorbis_book_encodev(codebook *book, const int *a, int n,
+                               oggpack_buffer *b);
 
 extern long vorbis_book_decode(codebook *book, oggpack_buffer *b);
 extern long vorbis_book_decodevs_add(codebook *book, float *a,
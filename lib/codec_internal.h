@@ -37,6 +37,16 @@ typedef struct vorbis_block_internal{
                                               blob [PACKETBLOBS/2] points to
                                               the oggpack_buffer in the
                                               main vorbis_block */
+
+  /* packetblobs not yet encoded (bitmask) and how the mapping encodes
+     one on demand; see vorbis_bitrate_blobs() */
+  int    blobs_pending;
+  void  *blob_state;
+  int  (*blob_encode)(vorbis_block *vb,int k,int **iwork);
+
+  /* the mapping's signal analysis of the block; that of the block
+     being followed after vorbis_analysis_blockout_follow() */
+  void  *spectrum;
 } vorbis_block_internal;
 
 typedef void vorbis_look_floor;
@@ -82,6 +92,19 @@ typedef struct private_state {
   bitrate_manager_state bms;
 
   ogg_int64_t sample_count;
+
+  /* analysis input.  v->pcm[] is a window into a fixed ring of
+     pcm_storage samples per channel, stored twice so the window is
+     always contiguous.  Writes too large for the ring are staged and
+     fed to it as blocks are taken out. */
+  float        **pcm_ring;
+  long           pcm_ringpos;
+  float        **pcm_stage;
+  long           pcm_stagesize;
+  long           pcm_stagehead;
+  long           pcm_stagetail;
+  int            pcm_staged;  /* last buffer handed out was the stage */
+  int            pcm_eof;     /* eof arrived with samples still staged */
 } private_state;
 
 /* codec_setup_info contains all the setup information specific to the
@@ -128,8 +151,35 @@ typedef struct codec_setup_info {
                                 highly redundant structure, but
                                 improves clarity of program flow. */
   int         halfrate_flag; /* painless downsample for decode */
+
+  /* encode only: set when the parameters and codebooks above belong
+     to a frozen configuration (see vorbis_encode_config_new()) rather
+     than to this codec_setup_info */
+  struct vorbis_encode_config *shared;
+
+  /* decode only: a shared setup of the same stream, made by the first
+     vorbis_info_copy() of this one, for later copies to attach to */
+  struct vorbis_encode_config *lent;
 } codec_setup_info;
 
+/* a frozen configuration owns a finished setup, its codebooks and,
+   for an encoder, its packed codebook header; every vorbis_info
+   instantiated from it holds a shallow copy of the codec_setup_info
+   and a reference.  Decoders of one stream share a setup the same
+   way (see ov_clone()) */
+struct vorbis_encode_config{
+  vorbis_info    vi;
+  unsigned char *header2;
+  long           header2_bytes;
+  vorbis_psy_tables *psy_tables[4]; /* held so encoders find them built */
+  int            refcount;
+};
+
+extern struct vorbis_encode_config *_vi_shared_freeze(vorbis_info *vi);
+extern int _vi_shared_attach(vorbis_info *vi,struct vorbis_encode_config *s);
+extern void _vi_shared_release(struct vorbis_encode_config *s);
+extern int _vi_decode_books(vorbis_info *vi);
+
 extern vorbis_look_psy_global *_vp_global_look(vorbis_info *vi);
 extern void _vp_global_free(vorbis_look_psy_global *look);
 
@@ -151,6 +201,8 @@ typedef struct {
   long phrasebits;
   long postbits;
   long frames;
+
+  void *fitwork;  /* encode only; floor1_fit() working space */
 } vorbis_look_floor1;
 
 
@@ -164,4 +216,9 @@ extern int *floor1_interpolate_fit(vorbis_block *vb,vorbis_look_floor1 *look,
 extern int floor1_encode(oggpack_buffer *opb,vorbis_block *vb,
                   vorbis_look_floor1 *look,
                   int *post,int *ilogmask);
+
+/* the backends' private lookups */
+extern const int floor0_look_size;
+extern const int floor0_map_size;
+extern const int res0_look_size;
 #endif
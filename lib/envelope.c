@@ -35,12 +35,19 @@ void _ve_envelope_init(envelope_lookup *e,vorbis_info *vi){
   int ch=vi->channels;
   int i,j;
   int n=e->winlength=128;
-  e->searchstep=64; /* not random */
+  e->searchstep=VE_STEP; /* not random */
 
   e->minenergy=gi->preecho_minenergy;
+  if(gi->envelope_mix && ch>1){
+    /* speed setting: detect on the average of the channels */
+    e->mix=_ogg_malloc((VE_BATCH*VE_STEP+n)*sizeof(*e->mix));
+    ch=1;
+  }
   e->ch=ch;
   e->storage=128;
   e->cursor=ci->blocksizes[1]/2;
+  _ve_latency(ci->blocksizes[0],ci->blocksizes[1],ci->hi.latency_max,
+              &e->lookahead);
   e->mdct_win=_ogg_calloc(n,sizeof(*e->mdct_win));
   mdct_init(&e->mdct,n);
 
@@ -70,6 +77,7 @@ void _ve_envelope_init(envelope_lookup *e,vorbis_info *vi){
 
   e->filter=_ogg_calloc(VE_BANDS*ch,sizeof(*e->filter));
   e->mark=_ogg_calloc(e->storage,sizeof(*e->mark));
+  e->spectra=_ogg_malloc(ch*VE_BATCH*(e->winlength/4+1)*sizeof(*e->spectra));
 
 }
 
@@ -81,15 +89,73 @@ void _ve_envelope_clear(envelope_lookup *e){
   _ogg_free(e->mdct_win);
   _ogg_free(e->filter);
   _ogg_free(e->mark);
+  _ogg_free(e->spectra);
+  if(e->mix)_ogg_free(e->mix);
   memset(e,0,sizeof(*e));
 }
 
+/* The front half of the detector has no state: window and transform
+   a run of search steps of one channel and reduce each to the near-DC
+   energy followed by the n/4 bin pair energies in dB (halved).  The
+   windows overlap by half, but each half is weighted differently by
+   the two windows, so only the input is shared. */
+
+static void _ve_spectra(envelope_lookup *ve,const float *data,int steps,
+                        float *out){
+  long n=ve->winlength;
+  long i;
+  int s;
+  float *vec=alloca(n*sizeof(*vec));
+
+  for(s=0;s<steps;s++,data+=ve->searchstep,out+=n/4+1){
+
+    /*_analysis_output_always("lpcm",seq2,data,n,0,0,
+      totalshift+pos*ve->searchstep);*/
+
+    /* window and transform */
+    for(i=0;i<n;i++)
+      vec[i]=data[i]*ve->mdct_win[i];
+    mdct_forward(&ve->mdct,vec,vec);
+
+    /*_analysis_output_always("mdct",seq2,vec,n/2,0,1,0); */
+
+    out[0]=vec[0]*vec[0]+.7*vec[1]*vec[1]+.2*vec[2]*vec[2];
+
+    /* yes, the MDCT results in all real coefficients, but it still
+       *behaves* like real/imaginary pairs */
+    i=0;
+#if defined(VORBIS_SSE2) && defined(VORBIS_IEEE_FLOAT32)
+    {
+      /* todB() four pairs at a time */
+      const __m128i absmask=_mm_set1_epi32(0x7fffffff);
+      const __m128 scale=_mm_set1_ps(7.17711438e-7f);
+      const __m128 offset=_mm_set1_ps(764.6161886f);
+      const __m128 half=_mm_set1_ps(.5f);
+      for(;i+8<=n/2;i+=8){
+        __m128 a=_mm_loadu_ps(vec+i);
+        __m128 b=_mm_loadu_ps(vec+i+4);
+        __m128 re=_mm_shuffle_ps(a,b,_MM_SHUFFLE(2,0,2,0));
+        __m128 im=_mm_shuffle_ps(a,b,_MM_SHUFFLE(3,1,3,1));
+        __m128 val=_mm_add_ps(_mm_mul_ps(re,re),_mm_mul_ps(im,im));
+        __m128i bits=_mm_and_si128(_mm_castps_si128(val),absmask);
+        val=_mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(bits),scale),offset);
+        _mm_storeu_ps(out+1+(i>>1),_mm_mul_ps(val,half));
+      }
+    }
+#endif
+    for(;i<n/2;i+=2){
+      float val=vec[i]*vec[i]+vec[i+1]*vec[i+1];
+      out[1+(i>>1)]=todB(&val)*.5f;
+    }
+  }
+}
+
 /* fairly straight threshhold-by-band based until we find something
    that works better and isn't patented. */
 
 static int _ve_amp(envelope_lookup *ve,
                    vorbis_info_psy_global *gi,
-                   float *data,
+                   const float *spectrum,
                    envelope_band *bands,
                    envelope_filter_state *filters){
   long n=ve->winlength;
@@ -102,7 +168,7 @@ static int _ve_amp(envelope_lookup *ve,
      itself (for low power signals) */
 
   float minV=ve->minenergy;
-  float *vec=alloca(n*sizeof(*vec));
+  float *vec=alloca(n/4*sizeof(*vec));
 
   /* stretch is used to gradually lengthen the number of windows
      considered prevoius-to-potential-trigger */
@@ -111,20 +177,10 @@ static int _ve_amp(envelope_lookup *ve,
   if(penalty<0.f)penalty=0.f;
   if(penalty>gi->stretch_penalty)penalty=gi->stretch_penalty;
 
-  /*_analysis_output_always("lpcm",seq2,data,n,0,0,
-    totalshift+pos*ve->searchstep);*/
-
- /* window and transform */
-  for(i=0;i<n;i++)
-    vec[i]=data[i]*ve->mdct_win[i];
-  mdct_forward(&ve->mdct,vec,vec);
-
-  /*_analysis_output_always("mdct",seq2,vec,n/2,0,1,0); */
-
   /* near-DC spreading function; this has nothing to do with
      psychoacoustics, just sidelobe leakage and window size */
   {
-    float temp=vec[0]*vec[0]+.7*vec[1]*vec[1]+.2*vec[2]*vec[2];
+    float temp=spectrum[0];
     int ptr=filters->nearptr;
 
     /* the accumulation is regularly refreshed from scratch to avoid
@@ -145,15 +201,12 @@ static int _ve_amp(envelope_lookup *ve,
     decay=todB(&decay)*.5-15.f;
   }
 
-  /* perform spreading and limiting, also smooth the spectrum.  yes,
-     the MDCT results in all real coefficients, but it still *behaves*
-     like real/imaginary pairs */
-  for(i=0;i<n/2;i+=2){
-    float val=vec[i]*vec[i]+vec[i+1]*vec[i+1];
-    val=todB(&val)*.5f;
+  /* perform spreading and limiting */
+  for(i=0;i<n/4;i++){
+    float val=spectrum[i+1];
     if(val<decay)val=decay;
     if(val<minV)val=minV;
-    vec[i>>1]=val;
+    vec[i]=val;
     decay-=8.;
   }
 
@@ -218,7 +271,8 @@ long _ve_envelope_search(vorbis_dsp_state *v){
   codec_setup_info *ci=vi->codec_setup;
   vorbis_info_psy_global *gi=&ci->psy_g_param;
   envelope_lookup *ve=((private_state *)(v->backend_state))->ve;
-  long i,j;
+  long i,j,k;
+  long stride=ve->winlength/4+1;
 
   int first=ve->current/ve->searchstep;
   int last=v->pcm_current/ve->searchstep-VE_WIN;
@@ -230,30 +284,54 @@ long _ve_envelope_search(vorbis_dsp_state *v){
     ve->mark=_ogg_realloc(ve->mark,ve->storage*sizeof(*ve->mark));
   }
 
-  for(j=first;j<last;j++){
-    int ret=0;
+  for(k=first;k<last;k+=VE_BATCH){
+    int steps=min(VE_BATCH,last-k);
+
+    /* transform a batch of steps per channel, then run the stateful
+       trigger logic over them in order */
+    if(ve->mix){
+      long n=ve->searchstep*(steps-1)+ve->winlength;
+      float scale=1.f/vi->channels;
+      long l;
+      for(l=0;l<n;l++)ve->mix[l]=0.f;
+      for(i=0;i<vi->channels;i++){
+        float *pcm=v->pcm[i]+ve->searchstep*(k);
+        for(l=0;l<n;l++)ve->mix[l]+=pcm[l];
+      }
+      for(l=0;l<n;l++)ve->mix[l]*=scale;
+      _ve_spectra(ve,ve->mix,steps,ve->spectra);
+    }else{
+      for(i=0;i<ve->ch;i++){
+        float *pcm=v->pcm[i]+ve->searchstep*(k);
+        _ve_spectra(ve,pcm,steps,ve->spectra+i*VE_BATCH*stride);
+      }
+    }
 
-    ve->stretch++;
-    if(ve->stretch>VE_MAXSTRETCH*2)
-      ve->stretch=VE_MAXSTRETCH*2;
+    for(j=k;j<k+steps;j++){
+      int ret=0;
 
-    for(i=0;i<ve->ch;i++){
-      float *pcm=v->pcm[i]+ve->searchstep*(j);
-      ret|=_ve_amp(ve,gi,pcm,ve->band,ve->filter+i*VE_BANDS);
-    }
+      ve->stretch++;
+      if(ve->stretch>VE_MAXSTRETCH*2)
+        ve->stretch=VE_MAXSTRETCH*2;
 
-    ve->mark[j+VE_POST]=0;
-    if(ret&1){
-      ve->mark[j]=1;
-      ve->mark[j+1]=1;
-    }
+      for(i=0;i<ve->ch;i++){
+        float *spectrum=ve->spectra+(i*VE_BATCH+j-k)*stride;
+        ret|=_ve_amp(ve,gi,spectrum,ve->band,ve->filter+i*VE_BANDS);
+      }
 
-    if(ret&2){
-      ve->mark[j]=1;
-      if(j>0)ve->mark[j-1]=1;
-    }
+      ve->mark[j+VE_POST]=0;
+      if(ret&1){
+        ve->mark[j]=1;
+        ve->mark[j+1]=1;
+      }
 
-    if(ret&4)ve->stretch=-1;
+      if(ret&2){
+        ve->mark[j]=1;
+        if(j>0)ve->mark[j-1]=1;
+      }
+
+      if(ret&4)ve->stretch=-1;
+    }
   }
 
   ve->current=last*ve->searchstep;
@@ -347,12 +425,43 @@ int _ve_envelope_mark(vorbis_dsp_state *v){
     long first=beginW/ve->searchstep;
     long last=endW/ve->searchstep;
     long i;
+    /* low delay; marks past the search aren't known yet */
+    if(ve->lookahead>=0 && last>ve->current/ve->searchstep+VE_POST)
+      last=ve->current/ve->searchstep+VE_POST;
     for(i=first;i<last;i++)
       if(ve->mark[i])return(1);
   }
   return(0);
 }
 
+/* Worst case number of samples the encoder holds past any input
+   sample before emitting the packet that completes it, given a cap
+   on that delay (0 for none).
+
+   Normally that is half a long block, then the next long block or the
+   search reaching far enough past it to rule out a short one, plus
+   the search's own lookahead (its window, and the step it holds back
+   for postecho).  Under a cap that would be exceeded,
+   only short blocks are used, so no search is waited for: a short
+   block plus at most enough lookahead to see all of that block's
+   impulse marks.  *lookahead gets the latter, or -1 if uncapped. */
+long _ve_latency(long shortb,long longb,long cap,long *lookahead){
+  long search=longb*3/4+shortb/4+(VE_WIN+2)*VE_STEP;
+  long normal=longb/2+max(longb,search);
+  long ahead;
+
+  if(cap<=0 || cap>=normal){
+    *lookahead=-1;
+    return(normal);
+  }
+
+  ahead=(cap-shortb)/VE_STEP*VE_STEP;
+  if(ahead<0)ahead=0;
+  if(ahead>(VE_WIN+1)*VE_STEP)ahead=(VE_WIN+1)*VE_STEP;
+  *lookahead=ahead;
+  return(shortb+ahead);
+}
+
 void _ve_envelope_shift(envelope_lookup *e,long shift){
   int smallsize=e->current/e->searchstep+VE_POST; /* adjust for placing marks
                                                      ahead of ve->current */
@@ -28,6 +28,9 @@
 #define VE_BANDS  7
 #define VE_NEARDC 15
 
+#define VE_BATCH  8   /* search steps transformed per pass */
+#define VE_STEP   64  /* search step in samples */
+
 #define VE_MINSTRETCH 2   /* a bit less than short block */
 #define VE_MAXSTRETCH 12  /* one-third full block */
 
@@ -63,11 +66,16 @@ typedef struct {
   int   stretch;
 
   int                   *mark;
+  float                 *spectra; /* VE_BATCH steps per channel */
+  float                 *mix;     /* channel mix of a batch, or NULL */
 
   long storage;
   long current;
   long curmark;
   long cursor;
+
+  long lookahead; /* low delay: samples past a short block to wait for
+                     impulse marking; -1 for normal block switching */
 } envelope_lookup;
 
 extern void _ve_envelope_init(envelope_lookup *e,vorbis_info *vi);
@@ -75,6 +83,7 @@ extern void _ve_envelope_clear(envelope_lookup *e);
 extern long _ve_envelope_search(vorbis_dsp_state *v);
 extern void _ve_envelope_shift(envelope_lookup *e,long shift);
 extern int  _ve_envelope_mark(vorbis_dsp_state *v);
+extern long _ve_latency(long shortb,long longb,long cap,long *lookahead);
 
 
 #endif
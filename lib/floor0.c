@@ -32,10 +32,36 @@
 #include "misc.h"
 #include <stdio.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/* linear to bark scale maps depend only on the block size, the rate
+   and the bark map size, so every stream using the same combination
+   shares one, along with the cosines vorbis_lsp_to_curve() wants for
+   each bark bin */
+typedef struct floor0_map {
+  int    n;
+  long   rate;
+  int    ln;
+  int   *linearmap; /* n entries and a -1 terminator */
+  float *cosw;      /* 2cos(pi*k/ln) for each bark bin k */
+
+  int    refcount;
+  struct floor0_map *next;
+} floor0_map;
+
+static floor0_map *map_cache=NULL;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t map_lock=PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void floor0_map_release(floor0_map *map);
+
 typedef struct {
   int ln;
   int  m;
-  int **linearmap;
+  floor0_map *map[2];
   int  n[2];
 
   vorbis_info_floor0 *vi;
@@ -44,6 +70,10 @@ typedef struct {
   long frames;
 } vorbis_look_floor0;
 
+/* for vorbis_synthesis_headercheck() */
+const int floor0_look_size=sizeof(vorbis_look_floor0);
+const int floor0_map_size=sizeof(floor0_map);
+
 
 /***********************************************/
 
@@ -59,13 +89,8 @@ static void floor0_free_look(vorbis_look_floor *i){
   vorbis_look_floor0 *look=(vorbis_look_floor0 *)i;
   if(look){
 
-    if(look->linearmap){
-
-      if(look->linearmap[0])_ogg_free(look->linearmap[0]);
-      if(look->linearmap[1])_ogg_free(look->linearmap[1]);
-
-      _ogg_free(look->linearmap);
-    }
+    floor0_map_release(look->map[0]);
+    floor0_map_release(look->map[1]);
     memset(look,0,sizeof(*look));
     _ogg_free(look);
   }
@@ -109,21 +134,27 @@ static vorbis_info_floor *floor0_unpack (vorbis_info *vi,oggpack_buffer *opb){
    Note that the scale depends on the sampling rate as well as the
    linear block and mapping sizes */
 
-static void floor0_map_lazy_init(vorbis_block      *vb,
-                                 vorbis_info_floor *infoX,
-                                 vorbis_look_floor0 *look){
-  if(!look->linearmap[vb->W]){
-    vorbis_dsp_state   *vd=vb->vd;
-    vorbis_info        *vi=vd->vi;
-    codec_setup_info   *ci=vi->codec_setup;
-    vorbis_info_floor0 *info=(vorbis_info_floor0 *)infoX;
-    int W=vb->W;
-    int n=ci->blocksizes[W]/2,j;
+static floor0_map *floor0_map_get(int n,long rate,int ln){
+  floor0_map *map;
+  int j;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&map_lock);
+#endif
+  for(map=map_cache;map;map=map->next)
+    if(map->n==n && map->rate==rate && map->ln==ln)break;
 
+  if(!map){
     /* we choose a scaling constant so that:
        floor(bark(rate/2-1)*C)=mapped-1
      floor(bark(rate/2)*C)=mapped */
-    float scale=look->ln/toBARK(info->rate/2.f);
+    float scale=ln/toBARK(rate/2.f);
+    float wdel=M_PI/ln;
+
+    map=_ogg_calloc(1,sizeof(*map));
+    map->n=n;
+    map->rate=rate;
+    map->ln=ln;
 
     /* the mapping from a linear scale to a smaller bark scale is
        straightforward.  We do *not* make sure that the linear mapping
@@ -131,27 +162,63 @@ static void floor0_map_lazy_init(vorbis_block      *vb,
        the encoder may do what it wishes in filling them.  They're
        necessary in some mapping combinations to keep the scale spacing
        accurate */
-    look->linearmap[W]=_ogg_malloc((n+1)*sizeof(**look->linearmap));
+    map->linearmap=_ogg_malloc((n+1)*sizeof(*map->linearmap));
     for(j=0;j<n;j++){
-      int val=floor( toBARK((info->rate/2.f)/n*j)
+      int val=floor( toBARK((rate/2.f)/n*j)
                      *scale); /* bark numbers represent band edges */
-      if(val>=look->ln)val=look->ln-1; /* guard against the approximation */
-      look->linearmap[W][j]=val;
+      if(val>=ln)val=ln-1; /* guard against the approximation */
+      map->linearmap[j]=val;
     }
-    look->linearmap[W][j]=-1;
-    look->n[W]=n;
+    map->linearmap[j]=-1;
+
+    map->cosw=_ogg_malloc(ln*sizeof(*map->cosw));
+    for(j=0;j<ln;j++)
+      map->cosw[j]=2.f*cos(wdel*j);
+
+    map->next=map_cache;
+    map_cache=map;
+  }
+  map->refcount++;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&map_lock);
+#endif
+  return map;
+}
+
+static void floor0_map_release(floor0_map *map){
+  floor0_map **p;
+
+  if(!map)return;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&map_lock);
+#endif
+  if(--map->refcount==0){
+    for(p=&map_cache;*p!=map;p=&(*p)->next);
+    *p=map->next;
+    _ogg_free(map->linearmap);
+    _ogg_free(map->cosw);
+    _ogg_free(map);
   }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&map_lock);
+#endif
 }
 
 static vorbis_look_floor *floor0_look(vorbis_dsp_state *vd,
                                       vorbis_info_floor *i){
   vorbis_info_floor0 *info=(vorbis_info_floor0 *)i;
+  codec_setup_info   *ci=vd->vi->codec_setup;
   vorbis_look_floor0 *look=_ogg_calloc(1,sizeof(*look));
+  int W;
+
   look->m=info->order;
   look->ln=info->barkmap;
   look->vi=info;
 
-  look->linearmap=_ogg_calloc(2,sizeof(*look->linearmap));
+  for(W=0;W<2;W++){
+    look->n[W]=ci->blocksizes[W]/2;
+    look->map[W]=floor0_map_get(look->n[W],info->rate,look->ln);
+  }
 
   return look;
 }
@@ -196,17 +263,15 @@ static int floor0_inverse2(vorbis_block *vb,vorbis_look_floor *i,
   vorbis_look_floor0 *look=(vorbis_look_floor0 *)i;
   vorbis_info_floor0 *info=look->vi;
 
-  floor0_map_lazy_init(vb,info,look);
-
   if(memo){
     float *lsp=(float *)memo;
     float amp=lsp[look->m];
 
     /* take the coefficients back to a spectral envelope curve */
     vorbis_lsp_to_curve(out,
-                        look->linearmap[vb->W],
+                        look->map[vb->W]->linearmap,
+                        look->map[vb->W]->cosw,
                         look->n[vb->W],
-                        look->ln,
                         lsp,look->m,amp,(float)info->ampdB);
     return(1);
   }
@@ -25,27 +25,31 @@
 #include "codebook.h"
 #include "misc.h"
 #include "scales.h"
+#include "os.h"
 
 #include <stdio.h>
 
 #define floor1_rangedB 140 /* floor 1 fixed at -140dB to 0dB range */
 
+/* the sums are unsigned: as running totals over a whole floor (see
+   accumulate_bins()) they outgrow an int, but the difference of two
+   totals, all a fit ever uses, is exact modulo 2^32 and small */
 typedef struct lsfit_acc{
   int x0;
   int x1;
 
-  int xa;
-  int ya;
-  int x2a;
-  int y2a;
-  int xya;
+  ogg_uint32_t xa;
+  ogg_uint32_t ya;
+  ogg_uint32_t x2a;
+  ogg_uint32_t y2a;
+  ogg_uint32_t xya;
   int an;
 
-  int xb;
-  int yb;
-  int x2b;
-  int y2b;
-  int xyb;
+  ogg_uint32_t xb;
+  ogg_uint32_t yb;
+  ogg_uint32_t x2b;
+  ogg_uint32_t y2b;
+  ogg_uint32_t xyb;
   int bn;
 } lsfit_acc;
 
@@ -67,6 +71,7 @@ static void floor1_free_look(vorbis_look_floor *i){
             (float)look->postbits/look->frames,
             (float)(look->postbits+look->phrasebits)/look->frames);*/
 
+    if(look->fitwork)_ogg_free(look->fitwork);
     memset(look,0,sizeof(*look));
     _ogg_free(look);
   }
@@ -206,6 +211,11 @@ static vorbis_look_floor *floor1_look(vorbis_dsp_state *vd,
   look->vi=info;
   look->n=info->postlist[1];
 
+  /* the fit needs O(n) scratch each time; keep it off the stack */
+  if(vd->analysisp)
+    look->fitwork=_ogg_malloc((look->n+1)*sizeof(lsfit_acc)+
+                              look->n*(sizeof(int)+1));
+
   /* we drop each position value in-between already decoded values,
      and use linear interpolation to predict each new value past the
      edges.  The positions are read in the order of the position
@@ -418,23 +428,25 @@ static void render_line0(int n, int x0,int x1,int y0,int y1,int *d){
   }
 }
 
-/* the floor has already been filtered to only include relevant sections */
-static int accumulate_fit(const float *flr,const float *mdct,
-                          int x0, int x1,lsfit_acc *a,
-                          int n,vorbis_info_floor1 *info){
+/* quantize the floor once and keep running sums of the line fit
+   terms, so that the fit accumulators of any range of bins are a
+   difference of two prefix entries.  sum[i] covers bins [0,i). */
+static void accumulate_bins(const float *flr,const float *mdct,
+                            int *q,unsigned char *over,lsfit_acc *sum,
+                            int n,vorbis_info_floor1 *info){
   long i;
+  ogg_uint32_t xa=0,ya=0,x2a=0,y2a=0,xya=0, xb=0,yb=0,x2b=0,y2b=0,xyb=0;
+  int na=0,nb=0;
 
-  int xa=0,ya=0,x2a=0,y2a=0,xya=0,na=0, xb=0,yb=0,x2b=0,y2b=0,xyb=0,nb=0;
-
-  memset(a,0,sizeof(*a));
-  a->x0=x0;
-  a->x1=x1;
-  if(x1>=n)x1=n-1;
-
-  for(i=x0;i<=x1;i++){
+  memset(sum,0,sizeof(*sum));
+  for(i=0;i<n;i++){
     int quantized=vorbis_dBquant(flr+i);
+    lsfit_acc *s=sum+i+1;
+
+    q[i]=quantized;
+    over[i]=(mdct[i]+info->twofitatten>=flr[i]);
     if(quantized){
-      if(mdct[i]+info->twofitatten>=flr[i]){
+      if(over[i]){
         xa  += i;
         ya  += quantized;
         x2a += i*i;
@@ -450,23 +462,49 @@ static int accumulate_fit(const float *flr,const float *mdct,
         nb++;
       }
     }
+
+    s->xa=xa;
+    s->ya=ya;
+    s->x2a=x2a;
+    s->y2a=y2a;
+    s->xya=xya;
+    s->an=na;
+
+    s->xb=xb;
+    s->yb=yb;
+    s->x2b=x2b;
+    s->y2b=y2b;
+    s->xyb=xyb;
+    s->bn=nb;
   }
+}
+
+/* the floor has already been filtered to only include relevant sections */
+static int accumulate_fit(const lsfit_acc *sum,int x0, int x1,lsfit_acc *a,
+                          int n){
+  const lsfit_acc *s0,*s1;
 
-  a->xa=xa;
-  a->ya=ya;
-  a->x2a=x2a;
-  a->y2a=y2a;
-  a->xya=xya;
-  a->an=na;
-
-  a->xb=xb;
-  a->yb=yb;
-  a->x2b=x2b;
-  a->y2b=y2b;
-  a->xyb=xyb;
-  a->bn=nb;
-
-  return(na);
+  a->x0=x0;
+  a->x1=x1;
+  if(x1>=n)x1=n-1;
+  s0=sum+x0;
+  s1=sum+x1+1;
+
+  a->xa=s1->xa-s0->xa;
+  a->ya=s1->ya-s0->ya;
+  a->x2a=s1->x2a-s0->x2a;
+  a->y2a=s1->y2a-s0->y2a;
+  a->xya=s1->xya-s0->xya;
+  a->an=s1->an-s0->an;
+
+  a->xb=s1->xb-s0->xb;
+  a->yb=s1->yb-s0->yb;
+  a->x2b=s1->x2b-s0->x2b;
+  a->y2b=s1->y2b-s0->y2b;
+  a->xyb=s1->xyb-s0->xyb;
+  a->bn=s1->bn-s0->bn;
+
+  return(a->an);
 }
 
 static int fit_line(lsfit_acc *a,int fits,int *y0,int *y1,
@@ -529,8 +567,8 @@ static int fit_line(lsfit_acc *a,int fits,int *y0,int *y1,
   }
 }
 
-static int inspect_error(int x0,int x1,int y0,int y1,const float *mask,
-                         const float *mdct,
+static int inspect_error(int x0,int x1,int y0,int y1,const int *q,
+                         const unsigned char *over,
                          vorbis_info_floor1 *info){
   int dy=y1-y0;
   int adx=x1-x0;
@@ -540,7 +578,7 @@ static int inspect_error(int x0,int x1,int y0,int y1,const float *mask,
   int x=x0;
   int y=y0;
   int err=0;
-  int val=vorbis_dBquant(mask+x);
+  int val=q[x];
   int mse=0;
   int n=0;
 
@@ -549,7 +587,7 @@ static int inspect_error(int x0,int x1,int y0,int y1,const float *mask,
   mse=(y-val);
   mse*=mse;
   n++;
-  if(mdct[x]+info->twofitatten>=mask[x]){
+  if(over[x]){
     if(y+info->maxover<val)return(1);
     if(y-info->maxunder>val)return(1);
   }
@@ -563,10 +601,10 @@ static int inspect_error(int x0,int x1,int y0,int y1,const float *mask,
       y+=base;
     }
 
-    val=vorbis_dBquant(mask+x);
+    val=q[x];
     mse+=((y-val)*(y-val));
     n++;
-    if(mdct[x]+info->twofitatten>=mask[x]){
+    if(over[x]){
       if(val){
         if(y+info->maxover<val)return(1);
         if(y-info->maxunder>val)return(1);
@@ -605,6 +643,9 @@ int *floor1_fit(vorbis_block *vb,vorbis_look_floor1 *look,
   int hineighbor[VIF_POSIT+2];
   int *output=NULL;
   int memo[VIF_POSIT+2];
+  lsfit_acc *sum=look->fitwork;
+  int *q=(int *)(sum+n+1);
+  unsigned char *over=(unsigned char *)(q+n);
 
   for(i=0;i<posts;i++)fit_valueA[i]=-200; /* mark all unused */
   for(i=0;i<posts;i++)fit_valueB[i]=-200; /* mark all unused */
@@ -614,13 +655,13 @@ int *floor1_fit(vorbis_block *vb,vorbis_look_floor1 *look,
 
   /* quantize the relevant floor points and collect them into line fit
      structures (one per minimal division) at the same time */
+  accumulate_bins(logmask,logmdct,q,over,sum,n,info);
   if(posts==0){
-    nonzero+=accumulate_fit(logmask,logmdct,0,n,fits,n,info);
+    nonzero+=accumulate_fit(sum,0,n,fits,n);
   }else{
     for(i=0;i<posts-1;i++)
-      nonzero+=accumulate_fit(logmask,logmdct,look->sorted_index[i],
-                              look->sorted_index[i+1],fits+i,
-                              n,info);
+      nonzero+=accumulate_fit(sum,look->sorted_index[i],
+                              look->sorted_index[i+1],fits+i,n);
   }
 
   if(nonzero){
@@ -661,7 +702,7 @@ int *floor1_fit(vorbis_block *vb,vorbis_look_floor1 *look,
             exit(1);
           }
 
-          if(inspect_error(lx,hx,ly,hy,logmask,logmdct,info)){
+          if(inspect_error(lx,hx,ly,hy,q,over,info)){
             /* outside error bounds/begin search area.  Split it. */
             int ly0=-200;
             int ly1=-200;
@@ -851,8 +892,10 @@ int floor1_encode(oggpack_buffer *opb,vorbis_block *vb,
     oggpack_write(opb,1,1);
 
     /* beginning/end post */
+#ifdef TRAIN_FLOOR1
     look->frames++;
     look->postbits+=ilog(look->quant_q-1)*2;
+#endif
     oggpack_write(opb,out[0],ilog(look->quant_q-1));
     oggpack_write(opb,out[1],ilog(look->quant_q-1));
 
@@ -891,7 +934,9 @@ int floor1_encode(oggpack_buffer *opb,vorbis_block *vb,
           cshift+=csubbits;
         }
         /* write it */
+#ifdef TRAIN_FLOOR1
         look->phrasebits+=
+#endif
           vorbis_book_encode(books+info->class_book[class],cval,opb);
 
 #ifdef TRAIN_FLOOR1
@@ -912,9 +957,12 @@ int floor1_encode(oggpack_buffer *opb,vorbis_block *vb,
         int book=info->class_subbook[class][bookas[k]];
         if(book>=0){
           /* hack to allow training with 'bad' books */
-          if(out[j+k]<(books+book)->entries)
-            look->postbits+=vorbis_book_encode(books+book,
-                                               out[j+k],opb);
+          if(out[j+k]<(books+book)->entries){
+#ifdef TRAIN_FLOOR1
+            look->postbits+=
+#endif
+              vorbis_book_encode(books+book,out[j+k],opb);
+          }
           /*else
             fprintf(stderr,"+!");*/
 
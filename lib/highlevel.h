@@ -43,6 +43,11 @@ typedef struct highlevel_encode_setup {
   int noise_normalize_p;
   int coupling_p;
 
+  int blobs_lazy;    /* managed mode: encode only the probed packetblobs */
+  int blobs_threads; /* managed mode: encode all packetblobs on a pool */
+  long latency_max;  /* cap on encoder delay in samples; 0 for none */
+  int speed;         /* analysis shortcuts; 0 for the full model */
+
   double stereo_point_setting;
   double lowpass_kHz;
   int    lowpass_altered;
@@ -31,6 +31,10 @@
 #include "misc.h"
 #include "os.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #define GENERAL_VENDOR_STRING "Xiph.Org libVorbis 1.3.3"
 #define ENCODE_VENDOR_STRING "Xiph.Org libVorbis I 20120203 (Omnipresent)"
 
@@ -45,6 +49,15 @@ static int ilog2(unsigned int v){
   return(ret);
 }
 
+static int icount(unsigned int v){
+  int ret=0;
+  while(v){
+    ret+=v&1;
+    v>>=1;
+  }
+  return(ret);
+}
+
 static void _v_writestring(oggpack_buffer *o,const char *s, int bytes){
 
   while(bytes--){
@@ -144,6 +157,169 @@ void vorbis_comment_clear(vorbis_comment *vc){
   }
 }
 
+/* comment header views ********************************************/
+
+struct vorbis_comment_view{
+  const char  *vendor;
+  int          vendor_length;
+  const char **user_comments;
+  int         *comment_lengths;
+  int          comments;
+
+  /* tag index, built by the first query.  Each hash chain runs in
+     header order so the count'th match is the count'th comment */
+  int         *taglen;  /* bytes before the '=', -1 if there is none */
+  int         *bucket;  /* first comment in each chain, or -1 */
+  int         *chain;   /* next comment in the same chain, or -1 */
+  int          buckets; /* a power of two */
+};
+
+static unsigned int _tag_hash(const char *tag,int n){
+  unsigned int h=2166136261U;
+  while(n--)h=(h^toupper((unsigned char)*tag++))*16777619U;
+  return h;
+}
+
+static void _comment_view_index(vorbis_comment_view *cv){
+  int i,j;
+
+  cv->buckets=1;
+  while(cv->buckets<cv->comments*2)cv->buckets<<=1;
+  cv->bucket=_ogg_malloc(cv->buckets*sizeof(*cv->bucket));
+  cv->taglen=_ogg_malloc((cv->comments+1)*sizeof(*cv->taglen));
+  cv->chain=_ogg_malloc((cv->comments+1)*sizeof(*cv->chain));
+  for(i=0;i<cv->buckets;i++)cv->bucket[i]=-1;
+
+  for(i=cv->comments-1;i>=0;i--){
+    const char *c=cv->user_comments[i];
+    unsigned int h;
+
+    for(j=0;j<cv->comment_lengths[i];j++)
+      if(c[j]=='=')break;
+    if(j==cv->comment_lengths[i]){
+      cv->taglen[i]=-1;
+      cv->chain[i]=-1;
+      continue;
+    }
+    h=_tag_hash(c,j)&(cv->buckets-1);
+    cv->taglen[i]=j;
+    cv->chain[i]=cv->bucket[h];
+    cv->bucket[h]=i;
+  }
+}
+
+/* the first comment with the given tag; step along with cv->chain */
+static int _comment_view_find(vorbis_comment_view *cv,const char *tag,
+                              int taglen,int i){
+  if(i<0){
+    if(!cv->bucket)_comment_view_index(cv);
+    i=cv->bucket[_tag_hash(tag,taglen)&(cv->buckets-1)];
+  }else
+    i=cv->chain[i];
+
+  for(;i>=0;i=cv->chain[i])
+    if(cv->taglen[i]==taglen && !tagcompare(cv->user_comments[i],tag,taglen))
+      break;
+  return i;
+}
+
+vorbis_comment_view *vorbis_comment_view_new(ogg_packet *op){
+  oggpack_buffer opb;
+  vorbis_comment_view *cv;
+  char buffer[6];
+  long len;
+  int i;
+
+  if(!op || !op->packet)return NULL;
+  oggpack_readinit(&opb,op->packet,op->bytes);
+  if(oggpack_read(&opb,8)!=0x03)return NULL;
+  _v_readstring(&opb,buffer,6);
+  if(memcmp(buffer,"vorbis",6))return NULL;
+
+  cv=_ogg_calloc(1,sizeof(*cv));
+
+  /* every field is whole bytes, so the strings can be pointed at
+     where they lie */
+  len=oggpack_read(&opb,32);
+  if(len<0 || len>opb.storage-oggpack_bytes(&opb))goto err_out;
+  cv->vendor=(char *)op->packet+oggpack_bytes(&opb);
+  cv->vendor_length=len;
+  oggpack_adv(&opb,len*8);
+
+  i=oggpack_read(&opb,32);
+  if(i<0 || i>((opb.storage-oggpack_bytes(&opb))>>2))goto err_out;
+  cv->comments=i;
+  cv->user_comments=_ogg_calloc(cv->comments+1,sizeof(*cv->user_comments));
+  cv->comment_lengths=_ogg_calloc(cv->comments+1,sizeof(*cv->comment_lengths));
+
+  for(i=0;i<cv->comments;i++){
+    len=oggpack_read(&opb,32);
+    if(len<0 || len>opb.storage-oggpack_bytes(&opb))goto err_out;
+    cv->user_comments[i]=(char *)op->packet+oggpack_bytes(&opb);
+    cv->comment_lengths[i]=len;
+    oggpack_adv(&opb,len*8);
+  }
+  if(oggpack_read(&opb,1)!=1)goto err_out; /* EOP check */
+
+  return cv;
+ err_out:
+  vorbis_comment_view_free(cv);
+  return NULL;
+}
+
+const char *vorbis_comment_view_vendor(vorbis_comment_view *cv,int *length){
+  if(length)*length=cv->vendor_length;
+  return cv->vendor;
+}
+
+int vorbis_comment_view_comments(vorbis_comment_view *cv){
+  return cv->comments;
+}
+
+const char *vorbis_comment_view_get(vorbis_comment_view *cv,int i,
+                                    int *length){
+  if(i<0 || i>=cv->comments)return NULL;
+  if(length)*length=cv->comment_lengths[i];
+  return cv->user_comments[i];
+}
+
+const char *vorbis_comment_view_query(vorbis_comment_view *cv,
+                                      const char *tag,int count,
+                                      int *length){
+  int taglen=strlen(tag);
+  int i=_comment_view_find(cv,tag,taglen,-1);
+
+  if(count<0)return NULL;
+  while(i>=0 && count--)
+    i=_comment_view_find(cv,tag,taglen,i);
+  if(i<0)return NULL;
+
+  /* the value follows the '=' */
+  if(length)*length=cv->comment_lengths[i]-taglen-1;
+  return cv->user_comments[i]+taglen+1;
+}
+
+int vorbis_comment_view_query_count(vorbis_comment_view *cv,const char *tag){
+  int taglen=strlen(tag);
+  int i=_comment_view_find(cv,tag,taglen,-1);
+  int count=0;
+
+  for(;i>=0;i=_comment_view_find(cv,tag,taglen,i))
+    count++;
+  return count;
+}
+
+void vorbis_comment_view_free(vorbis_comment_view *cv){
+  if(cv){
+    if(cv->user_comments)_ogg_free(cv->user_comments);
+    if(cv->comment_lengths)_ogg_free(cv->comment_lengths);
+    if(cv->taglen)_ogg_free(cv->taglen);
+    if(cv->bucket)_ogg_free(cv->bucket);
+    if(cv->chain)_ogg_free(cv->chain);
+    _ogg_free(cv);
+  }
+}
+
 /* blocksize 0 is guaranteed to be short, 1 is guaranteed to be long.
    They may be equal, but short will never ge greater than long */
 int vorbis_info_blocksize(vorbis_info *vi,int zo){
@@ -161,6 +337,16 @@ void vorbis_info_clear(vorbis_info *vi){
   codec_setup_info     *ci=vi->codec_setup;
   int i;
 
+  if(ci && ci->lent)
+    _vi_shared_release(ci->lent);
+
+  if(ci && ci->shared){
+    /* everything but the copy itself belongs to the configuration */
+    _vi_shared_release(ci->shared);
+    _ogg_free(ci);
+    ci=NULL;
+  }
+
   if(ci){
 
     for(i=0;i<ci->modes;i++)
@@ -432,6 +618,488 @@ int vorbis_synthesis_headerin(vorbis_info *vi,vorbis_comment *vc,ogg_packet *op)
   return(OV_EBADHEADER);
 }
 
+/* setup header checking *********************************************/
+
+/* vorbis_synthesis_headercheck() reads the headers exactly as
+   vorbis_synthesis_headerin() and vorbis_synthesis_init() would, and
+   rejects what they would reject, but stores nothing beyond this much
+   of each codebook */
+typedef struct {
+  long entries;
+  int  dim;
+  int  maptype;
+} check_book;
+
+/* the heap chunk a typical malloc() carves for n bytes: the size plus
+   a one word header, rounded up to two words, and never less than
+   four */
+static long _check_chunk(long n){
+  long w=sizeof(void *);
+  long chunk=(n+w+2*w-1)&~(2*w-1);
+  return chunk<4*w?4*w:chunk;
+}
+
+/* counts one allocation the decoder will keep */
+static void _check_alloc(long *bytes,long n){
+  *bytes+=_check_chunk(n);
+}
+
+/* counts one temporary the decoder frees again while it is set up.  A
+   typical malloc() keeps a few freed chunks of each small size cached
+   per thread rather than returning them, so the first few of each
+   size are still counted */
+#define CHECK_CACHED_SIZES 64
+#define CHECK_CACHED_EACH  7
+
+static void _check_temp(long *bytes,unsigned char *cached,long n){
+  long chunk=_check_chunk(n);
+  long i=chunk/(2*sizeof(void *))-2;
+  if(i<CHECK_CACHED_SIZES && cached[i]<CHECK_CACHED_EACH){
+    cached[i]++;
+    *bytes+=chunk;
+  }
+}
+
+/* one step of _make_words()' codeword assignment; fails on an
+   overpopulated tree */
+static int _check_word(ogg_uint32_t *marker,int length){
+  ogg_uint32_t entry=marker[length];
+  int j;
+
+  if(length<32 && (entry>>length))return -1;
+  for(j=length;j>0;j--){
+    if(marker[j]&1){
+      if(j==1)
+        marker[1]++;
+      else
+        marker[j]=marker[j-1]<<1;
+      break;
+    }
+    marker[j]++;
+  }
+  for(j=length+1;j<33;j++)
+    if((marker[j]>>1) == entry){
+      entry=marker[j];
+      marker[j]=marker[j-1]<<1;
+    }else
+      break;
+  return 0;
+}
+
+/* as vorbis_staticbook_unpack() and vorbis_book_init_decode(); counts
+   the decode tables */
+static int _check_book(oggpack_buffer *opb,check_book *b,long *bytes,
+                       unsigned char *cached){
+  ogg_uint32_t marker[33];
+  codebook *c=NULL;
+  long i,used=0,quantvals=0;
+  int tablen;
+
+  memset(marker,0,sizeof(marker));
+  if(oggpack_read(opb,24)!=0x564342)return -1;
+  b->dim=oggpack_read(opb,16);
+  b->entries=oggpack_read(opb,24);
+  if(b->entries==-1)return -1;
+  if(_ilog(b->dim)+_ilog(b->entries)>24)return -1;
+
+  switch((int)oggpack_read(opb,1)){
+  case 0:{
+    long unused=oggpack_read(opb,1);
+    if((b->entries*(unused?1:5)+7)>>3>opb->storage-oggpack_bytes(opb))
+      return -1;
+    for(i=0;i<b->entries;i++){
+      long num;
+      if(unused && !oggpack_read(opb,1))continue;
+      num=oggpack_read(opb,5);
+      if(num==-1 || _check_word(marker,num+1))return -1;
+      used++;
+    }
+    break;
+  }
+  case 1:{
+    long length=oggpack_read(opb,5)+1;
+    if(length==0)return -1;
+    for(i=0;i<b->entries;){
+      long num=oggpack_read(opb,_ilog(b->entries-i));
+      if(num==-1)return -1;
+      if(length>32 || num>b->entries-i ||
+         (num>0 && (num-1)>>(length-1)>1))return -1;
+      for(;num>0;num--,i++)
+        if(_check_word(marker,length))return -1;
+      length++;
+    }
+    used=b->entries;
+    break;
+  }
+  default:
+    return -1;
+  }
+
+  switch((b->maptype=oggpack_read(opb,4))){
+  case 0:
+    break;
+  case 1: case 2:{
+    int q_quant,q_sequencep;
+    oggpack_read(opb,32);
+    oggpack_read(opb,32);
+    q_quant=oggpack_read(opb,4)+1;
+    q_sequencep=oggpack_read(opb,1);
+    if(q_sequencep==-1)return -1;
+
+    if(b->maptype==1){
+      if(b->dim){
+        static_codebook s;
+        memset(&s,0,sizeof(s));
+        s.dim=b->dim;
+        s.entries=b->entries;
+        quantvals=_book_maptype1_quantvals(&s);
+      }
+    }else
+      quantvals=b->entries*b->dim;
+
+    if(((quantvals*q_quant+7)>>3)>opb->storage-oggpack_bytes(opb))
+      return -1;
+    if(quantvals){
+      oggpack_adv(opb,quantvals*q_quant);
+      if(!opb->ptr)return -1;
+    }
+    break;
+  }
+  default:
+    return -1;
+  }
+
+  /* an underpopulated tree is only allowed for a single codeword */
+  if(used>1)
+    for(i=1;i<33;i++)
+      if(marker[i] & (0xffffffffUL>>(32-i)))return -1;
+
+  /* the static book, freed as its decode form is built */
+  _check_temp(bytes,cached,sizeof(static_codebook));
+  _check_temp(bytes,cached,b->entries*sizeof(long));
+  if(b->maptype)
+    _check_temp(bytes,cached,quantvals*sizeof(long));
+
+  if(used>0){
+    _check_temp(bytes,cached,used*sizeof(ogg_uint32_t));
+    tablen=_ilog(used)-4;
+    if(tablen<5)tablen=5;
+    if(tablen>8)tablen=8;
+    _check_alloc(bytes,used*sizeof(*c->codelist));
+    _check_alloc(bytes,used*sizeof(*c->dec_index));
+    _check_alloc(bytes,used*sizeof(*c->dec_codelengths));
+    _check_alloc(bytes,(1<<tablen)*sizeof(*c->dec_firsttable));
+    if(b->maptype)
+      _check_alloc(bytes,used*b->dim*sizeof(*c->valuelist));
+  }
+  return 0;
+}
+
+static int _check_floor0(oggpack_buffer *opb,check_book *books,int nbooks,
+                         long *blocksizes,long *bytes){
+  vorbis_info_floor0 *info=NULL;
+  int j,order,rate,barkmap,numbooks;
+
+  order=oggpack_read(opb,8);
+  rate=oggpack_read(opb,16);
+  barkmap=oggpack_read(opb,16);
+  oggpack_read(opb,6);
+  oggpack_read(opb,8);
+  numbooks=oggpack_read(opb,4)+1;
+  if(order<1 || rate<1 || barkmap<1 || numbooks<1)return -1;
+
+  for(j=0;j<numbooks;j++){
+    int book=oggpack_read(opb,8);
+    if(book<0 || book>=nbooks)return -1;
+    if(books[book].maptype==0 || books[book].dim<1)return -1;
+  }
+
+  _check_alloc(bytes,sizeof(*info));
+  _check_alloc(bytes,floor0_look_size);
+
+  /* and the bark map and cosines for each block size */
+  for(j=0;j<2;j++){
+    if(j && blocksizes[1]==blocksizes[0])break;
+    _check_alloc(bytes,floor0_map_size);
+    _check_alloc(bytes,(blocksizes[j]/2+1)*sizeof(int));
+    _check_alloc(bytes,barkmap*sizeof(float));
+  }
+  return 0;
+}
+
+static int _check_floor1(oggpack_buffer *opb,int nbooks,long *bytes){
+  vorbis_info_floor1 info;
+  int j,k,count=0,maxclass=-1,rangebits;
+
+  memset(&info,0,sizeof(info));
+  info.partitions=oggpack_read(opb,5);
+  for(j=0;j<info.partitions;j++){
+    info.partitionclass[j]=oggpack_read(opb,4);
+    if(info.partitionclass[j]<0)return -1;
+    if(maxclass<info.partitionclass[j])maxclass=info.partitionclass[j];
+  }
+
+  for(j=0;j<maxclass+1;j++){
+    info.class_dim[j]=oggpack_read(opb,3)+1;
+    info.class_subs[j]=oggpack_read(opb,2);
+    if(info.class_subs[j]<0)return -1;
+    if(info.class_subs[j])info.class_book[j]=oggpack_read(opb,8);
+    if(info.class_book[j]<0 || info.class_book[j]>=nbooks)return -1;
+    for(k=0;k<(1<<info.class_subs[j]);k++){
+      int book=oggpack_read(opb,8)-1;
+      if(book<-1 || book>=nbooks)return -1;
+    }
+  }
+
+  oggpack_read(opb,2);
+  rangebits=oggpack_read(opb,4);
+  if(rangebits<0)return -1;
+
+  for(j=0,k=0;j<info.partitions;j++){
+    count+=info.class_dim[info.partitionclass[j]];
+    if(count>VIF_POSIT)return -1;
+    for(;k<count;k++){
+      int t=info.postlist[k+2]=oggpack_read(opb,rangebits);
+      if(t<0 || t>=(1<<rangebits))return -1;
+    }
+  }
+  info.postlist[0]=0;
+  info.postlist[1]=1<<rangebits;
+
+  /* no repeated posts */
+  for(j=1;j<count+2;j++)
+    for(k=0;k<j;k++)
+      if(info.postlist[j]==info.postlist[k])return -1;
+
+  _check_alloc(bytes,sizeof(info));
+  _check_alloc(bytes,sizeof(vorbis_look_floor1));
+  return 0;
+}
+
+static int _check_residue(oggpack_buffer *opb,check_book *books,int nbooks,
+                          long *bytes){
+  vorbis_info_residue0 *info=NULL;
+  int j,acc=0,partitions,groupbook,dim;
+  long partvals=1;
+
+  oggpack_read(opb,24);
+  oggpack_read(opb,24);
+  oggpack_read(opb,24);
+  partitions=oggpack_read(opb,6)+1;
+  groupbook=oggpack_read(opb,8);
+  if(groupbook<0)return -1;
+
+  _check_alloc(bytes,sizeof(*info));
+  _check_alloc(bytes,res0_look_size);
+  _check_alloc(bytes,partitions*sizeof(codebook **));
+  for(j=0;j<partitions;j++){
+    int cascade=oggpack_read(opb,3);
+    int cflag=oggpack_read(opb,1);
+    if(cflag<0)return -1;
+    if(cflag){
+      int c=oggpack_read(opb,5);
+      if(c<0)return -1;
+      cascade|=(c<<3);
+    }
+    acc+=icount(cascade);
+    if(cascade)
+      _check_alloc(bytes,_ilog(cascade)*sizeof(codebook *));
+  }
+  for(j=0;j<acc;j++){
+    int book=oggpack_read(opb,8);
+    if(book<0 || book>=nbooks || books[book].maptype==0)return -1;
+  }
+  if(groupbook>=nbooks)return -1;
+
+  /* the partitioning must be possible with the phrasebook */
+  dim=books[groupbook].dim;
+  if(dim<1)return -1;
+  for(j=0;j<dim;j++){
+    partvals*=partitions;
+    if(partvals>books[groupbook].entries)return -1;
+  }
+
+  /* the look's decode map */
+  _check_alloc(bytes,partvals*sizeof(int *));
+  for(j=0;j<partvals;j++)
+    _check_alloc(bytes,dim*sizeof(int));
+  return 0;
+}
+
+static int _check_mapping(oggpack_buffer *opb,int channels,int floors,
+                          int residues,long *bytes){
+  vorbis_info_mapping0 *info=NULL;
+  int i,b,submaps=1;
+
+  b=oggpack_read(opb,1);
+  if(b<0)return -1;
+  if(b){
+    submaps=oggpack_read(opb,4)+1;
+    if(submaps<=0)return -1;
+  }
+
+  b=oggpack_read(opb,1);
+  if(b<0)return -1;
+  if(b){
+    int steps=oggpack_read(opb,8)+1;
+    if(steps<=0)return -1;
+    for(i=0;i<steps;i++){
+      int testM=oggpack_read(opb,ilog2(channels));
+      int testA=oggpack_read(opb,ilog2(channels));
+      if(testM<0 || testA<0 || testM==testA ||
+         testM>=channels || testA>=channels)return -1;
+    }
+  }
+
+  if(oggpack_read(opb,2)!=0)return -1;
+
+  if(submaps>1)
+    for(i=0;i<channels;i++){
+      int mux=oggpack_read(opb,4);
+      if(mux>=submaps || mux<0)return -1;
+    }
+  for(i=0;i<submaps;i++){
+    int floor,residue;
+    oggpack_read(opb,8);
+    floor=oggpack_read(opb,8);
+    if(floor>=floors || floor<0)return -1;
+    residue=oggpack_read(opb,8);
+    if(residue>=residues || residue<0)return -1;
+  }
+
+  _check_alloc(bytes,sizeof(*info));
+  return 0;
+}
+
+/* checks a stream's identification and setup headers without
+   unpacking them, and computes the heap a decoder for the stream will
+   hold once set up */
+int vorbis_synthesis_headercheck(ogg_packet *id,ogg_packet *setup,
+                                 long *bytes){
+  oggpack_buffer opb;
+  check_book books[256];
+  char buffer[6];
+  unsigned char cached[CHECK_CACHED_SIZES];
+  long blocksizes[2],mem;
+  int channels,nbooks,floors,residues,maps,modes;
+  int i,type,ret=OV_EBADHEADER;
+
+  if(!id || !setup)return(OV_EBADHEADER);
+
+  /* identification header */
+  oggpack_readinit(&opb,id->packet,id->bytes);
+  type=oggpack_read(&opb,8);
+  memset(buffer,0,6);
+  _v_readstring(&opb,buffer,6);
+  if(memcmp(buffer,"vorbis",6))return(OV_ENOTVORBIS);
+  if(type!=0x01 || !id->b_o_s)return(OV_EBADHEADER);
+  if(oggpack_read(&opb,32)!=0)return(OV_EVERSION);
+  channels=oggpack_read(&opb,8);
+  if(oggpack_read(&opb,32)<1)return(OV_EBADHEADER); /* rate */
+  oggpack_read(&opb,32);
+  oggpack_read(&opb,32);
+  oggpack_read(&opb,32);
+  blocksizes[0]=1<<oggpack_read(&opb,4);
+  blocksizes[1]=1<<oggpack_read(&opb,4);
+  if(channels<1)return(OV_EBADHEADER);
+  if(blocksizes[0]<64)return(OV_EBADHEADER);
+  if(blocksizes[1]<blocksizes[0])return(OV_EBADHEADER);
+  if(blocksizes[1]>8192)return(OV_EBADHEADER);
+  if(oggpack_read(&opb,1)!=1)return(OV_EBADHEADER);
+
+  /* setup header */
+  oggpack_readinit(&opb,setup->packet,setup->bytes);
+  type=oggpack_read(&opb,8);
+  memset(buffer,0,6);
+  _v_readstring(&opb,buffer,6);
+  if(memcmp(buffer,"vorbis",6))return(OV_ENOTVORBIS);
+  if(type!=0x05)return(OV_EBADHEADER);
+
+  mem=0;
+  memset(cached,0,sizeof(cached));
+  _check_alloc(&mem,sizeof(codec_setup_info));
+
+  nbooks=oggpack_read(&opb,8)+1;
+  if(nbooks<=0)goto err_out;
+  _check_alloc(&mem,nbooks*sizeof(codebook));
+  for(i=0;i<nbooks;i++)
+    if(_check_book(&opb,books+i,&mem,cached))goto err_out;
+
+  {
+    int times=oggpack_read(&opb,6)+1;
+    if(times<=0)goto err_out;
+    for(i=0;i<times;i++){
+      int test=oggpack_read(&opb,16);
+      if(test<0 || test>=VI_TIMEB)goto err_out;
+    }
+  }
+
+  floors=oggpack_read(&opb,6)+1;
+  if(floors<=0)goto err_out;
+  for(i=0;i<floors;i++){
+    type=oggpack_read(&opb,16);
+    if(type<0 || type>=VI_FLOORB)goto err_out;
+    if(type==0?
+       _check_floor0(&opb,books,nbooks,blocksizes,&mem):
+       _check_floor1(&opb,nbooks,&mem))goto err_out;
+  }
+
+  residues=oggpack_read(&opb,6)+1;
+  if(residues<=0)goto err_out;
+  for(i=0;i<residues;i++){
+    type=oggpack_read(&opb,16);
+    if(type<0 || type>=VI_RESB)goto err_out;
+    if(_check_residue(&opb,books,nbooks,&mem))goto err_out;
+  }
+
+  maps=oggpack_read(&opb,6)+1;
+  if(maps<=0)goto err_out;
+  for(i=0;i<maps;i++){
+    type=oggpack_read(&opb,16);
+    if(type<0 || type>=VI_MAPB)goto err_out;
+    if(_check_mapping(&opb,channels,floors,residues,&mem))goto err_out;
+  }
+
+  modes=oggpack_read(&opb,6)+1;
+  if(modes<=0)goto err_out;
+  for(i=0;i<modes;i++){
+    int windowtype,transformtype,mapping;
+    oggpack_read(&opb,1);
+    windowtype=oggpack_read(&opb,16);
+    transformtype=oggpack_read(&opb,16);
+    mapping=oggpack_read(&opb,8);
+    if(windowtype>=VI_WINDOWB)goto err_out;
+    if(transformtype>=VI_WINDOWB)goto err_out;
+    if(mapping>=maps || mapping<0)goto err_out;
+    _check_alloc(&mem,sizeof(vorbis_info_mode));
+  }
+
+  if(oggpack_read(&opb,1)!=1)goto err_out;
+
+  /* the synthesis state: both mdcts, the pcm, the floor and residue
+     lookup vectors, and the block storage vorbis_block_init()
+     reserves */
+  _check_alloc(&mem,sizeof(private_state));
+  for(i=0;i<2;i++){
+    _check_alloc(&mem,VI_TRANSFORMB*sizeof(vorbis_look_transform *));
+    _check_alloc(&mem,sizeof(mdct_lookup));
+    _check_alloc(&mem,blocksizes[i]/4*sizeof(int));
+    _check_alloc(&mem,(blocksizes[i]+blocksizes[i]/4)*sizeof(float));
+  }
+  _check_alloc(&mem,channels*sizeof(float *));
+  _check_alloc(&mem,channels*sizeof(float *));
+  for(i=0;i<channels;i++)
+    _check_alloc(&mem,blocksizes[1]*sizeof(float));
+  _check_alloc(&mem,floors*sizeof(vorbis_look_floor *));
+  _check_alloc(&mem,residues*sizeof(vorbis_look_residue *));
+  _check_alloc(&mem,channels*blocksizes[1]*sizeof(float)*5/4);
+
+  if(bytes)*bytes=mem;
+  ret=0;
+ err_out:
+  return(ret);
+}
+
 /* pack side **********************************************************/
 
 static int _vorbis_pack_info(oggpack_buffer *opb,vorbis_info *vi){
@@ -544,6 +1212,210 @@ err_out:
   return(-1);
 }
 
+/* frozen and shared configurations *********************************/
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t shared_lock=PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void _vi_attach(vorbis_info *vi,struct vorbis_encode_config *s){
+  codec_setup_info *ci=vi->codec_setup;
+
+  memcpy(ci,s->vi.codec_setup,sizeof(*ci));
+  ci->shared=s;
+  *vi=s->vi;
+  vi->codec_setup=ci;
+}
+
+/* moves vi's setup into s; handles is the number of references held
+   other than vi's own */
+static void _vi_share(vorbis_info *vi,struct vorbis_encode_config *s,
+                      int handles){
+  s->vi=*vi;
+  s->refcount=handles+1;
+  vi->codec_setup=_ogg_calloc(1,sizeof(codec_setup_info));
+  _vi_attach(vi,s);
+}
+
+/* takes over the finished encode setup in vi; vi is left as an
+   instance of the returned configuration */
+struct vorbis_encode_config *_vi_shared_freeze(vorbis_info *vi){
+  codec_setup_info *ci=vi->codec_setup;
+  struct vorbis_encode_config *s;
+  oggpack_buffer opb;
+  int i;
+
+  if(!ci || ci->shared || !ci->hi.set_in_stone)return NULL;
+
+  oggpack_writeinit(&opb);
+  if(_vorbis_pack_books(&opb,vi)){
+    oggpack_writeclear(&opb);
+    return NULL;
+  }
+
+  s=_ogg_calloc(1,sizeof(*s));
+  s->header2_bytes=oggpack_bytes(&opb);
+  s->header2=_ogg_malloc(s->header2_bytes);
+  memcpy(s->header2,opb.buffer,s->header2_bytes);
+  oggpack_writeclear(&opb);
+
+  /* otherwise built by every vorbis_analysis_init() */
+  if(!ci->fullbooks){
+    ci->fullbooks=_ogg_calloc(ci->books,sizeof(*ci->fullbooks));
+    for(i=0;i<ci->books;i++)
+      vorbis_book_init_encode(ci->fullbooks+i,ci->book_param[i]);
+  }
+
+  for(i=0;i<ci->psys;i++)
+    s->psy_tables[i]=
+      _vp_psy_tables_pin(ci->psy_param[i],&ci->psy_g_param,
+                         ci->blocksizes[ci->psy_param[i]->blockflag]/2,
+                         vi->rate);
+
+  _vi_share(vi,s,1);
+  return s;
+}
+
+/* builds the decode codebooks; the static books are released as each
+   one is unpacked into its decode form */
+int _vi_decode_books(vorbis_info *vi){
+  codec_setup_info *ci=vi->codec_setup;
+  int i;
+
+  if(ci->fullbooks)return 0;
+
+  ci->fullbooks=_ogg_calloc(ci->books,sizeof(*ci->fullbooks));
+  for(i=0;i<ci->books;i++){
+    if(ci->book_param[i]==NULL)
+      goto abort_books;
+    if(vorbis_book_init_decode(ci->fullbooks+i,ci->book_param[i]))
+      goto abort_books;
+    /* decode codebooks are now standalone after init */
+    vorbis_staticbook_destroy(ci->book_param[i]);
+    ci->book_param[i]=NULL;
+  }
+  return 0;
+
+ abort_books:
+  for(i=0;i<ci->books;i++){
+    if(ci->book_param[i]!=NULL){
+      vorbis_staticbook_destroy(ci->book_param[i]);
+      ci->book_param[i]=NULL;
+    }
+    vorbis_book_clear(ci->fullbooks+i);
+  }
+  _ogg_free(ci->fullbooks);
+  ci->fullbooks=NULL;
+  return -1;
+}
+
+/* moves the decode setup of vi into a shared configuration, building
+   its decode codebooks first.  Must be done before vi is used or
+   copied from other threads */
+int vorbis_info_share(vorbis_info *vi){
+  codec_setup_info *ci;
+  int ret=0;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&shared_lock);
+#endif
+  ci=vi->codec_setup;
+  if(!ci || ci->hi.setup || !ci->modes)
+    ret=OV_EINVAL;
+  else if(!ci->shared){
+    if(_vi_decode_books(vi))
+      ret=OV_EBADHEADER;
+    else
+      _vi_share(vi,_ogg_calloc(1,sizeof(struct vorbis_encode_config)),0);
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&shared_lock);
+#endif
+  return ret;
+}
+
+/* lets vi decode the same stream as src without a setup or codebooks
+   of its own.  vi is either fresh from vorbis_info_init(), or holds
+   a decode setup read from src's headers; if src has nothing to share
+   yet, the latter is shared and lent to src for later copies.  src
+   itself is only ever read, so it may be decoding meanwhile */
+int vorbis_info_copy(vorbis_info *vi,vorbis_info *src){
+  codec_setup_info *ci=vi->codec_setup;
+  codec_setup_info *si=src->codec_setup;
+  struct vorbis_encode_config *s;
+  int ret=0;
+
+  if(!ci || !si || si->hi.setup || ci->shared || ci->hi.setup)
+    return OV_EINVAL;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&shared_lock);
+#endif
+  s=si->shared?si->shared:si->lent;
+  if(s)
+    s->refcount++;
+  else if(!ci->modes)
+    ret=OV_EINVAL;
+  else if(_vi_decode_books(vi))
+    ret=OV_EBADHEADER;
+  else{
+    _vi_share(vi,_ogg_calloc(1,sizeof(*s)),1);
+    si->lent=((codec_setup_info *)vi->codec_setup)->shared;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&shared_lock);
+#endif
+
+  if(s){
+    /* another copy lent src a setup first */
+    if(ci->modes){
+      vorbis_info_clear(vi);
+      vorbis_info_init(vi);
+    }
+    _vi_attach(vi,s);
+  }
+  return ret;
+}
+
+/* vi must be fresh from vorbis_info_init() */
+int _vi_shared_attach(vorbis_info *vi,struct vorbis_encode_config *s){
+  codec_setup_info *ci=vi->codec_setup;
+
+  if(!ci || ci->shared || ci->modes || ci->books || ci->hi.setup)
+    return OV_EINVAL;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&shared_lock);
+#endif
+  s->refcount++;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&shared_lock);
+#endif
+  _vi_attach(vi,s);
+  return 0;
+}
+
+void _vi_shared_release(struct vorbis_encode_config *s){
+  int refs;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&shared_lock);
+#endif
+  refs=--s->refcount;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&shared_lock);
+#endif
+
+  if(refs==0){
+    int i;
+    for(i=0;i<4;i++)
+      _vp_psy_tables_unpin(s->psy_tables[i]);
+    vorbis_info_clear(&s->vi);
+    _ogg_free(s->header2);
+    _ogg_free(s);
+  }
+}
+
 int vorbis_commentheader_out(vorbis_comment *vc,
                                           ogg_packet *op){
 
@@ -575,8 +1447,11 @@ int vorbis_analysis_headerout(vorbis_dsp_state *v,
                               ogg_packet *op_code){
   int ret=OV_EIMPL;
   vorbis_info *vi=v->vi;
+  codec_setup_info *ci=vi->codec_setup;
   oggpack_buffer opb;
   private_state *b=v->backend_state;
+  unsigned char *code;
+  long codebytes;
 
   if(!b){
     ret=OV_EFAULT;
@@ -616,14 +1491,22 @@ int vorbis_analysis_headerout(vorbis_dsp_state *v,
 
   /* third header packet (modes/codebooks) ****************************/
 
-  oggpack_reset(&opb);
-  if(_vorbis_pack_books(&opb,vi))goto err_out;
+  if(ci->shared){
+    /* packed once when the configuration was frozen */
+    code=ci->shared->header2;
+    codebytes=ci->shared->header2_bytes;
+  }else{
+    oggpack_reset(&opb);
+    if(_vorbis_pack_books(&opb,vi))goto err_out;
+    code=opb.buffer;
+    codebytes=oggpack_bytes(&opb);
+  }
 
   if(b->header2)_ogg_free(b->header2);
-  b->header2=_ogg_malloc(oggpack_bytes(&opb));
-  memcpy(b->header2,opb.buffer,oggpack_bytes(&opb));
+  b->header2=_ogg_malloc(codebytes);
+  memcpy(b->header2,code,codebytes);
   op_code->packet=b->header2;
-  op_code->bytes=oggpack_bytes(&opb);
+  op_code->bytes=codebytes;
   op_code->b_o_s=0;
   op_code->e_o_s=0;
   op_code->granulepos=0;
@@ -66,8 +66,49 @@ float vorbis_lpc_from_data(float *data,float *lpci,int n,int m){
   int i,j;
 
   /* autocorrelation, p+1 lag coefficients */
-  j=m+1;
-  while(j--){
+  j=0;
+#ifdef VORBIS_SSE2
+  /* eight lags per pass over a double copy of the data, so each lane
+     pair is a single load.  Each lag still sums in sample order */
+  if(m>=7 && n>7){
+    double *dd=_ogg_malloc(n*sizeof(*dd));
+    for(i=0;i<n;i++)dd[i]=data[i];
+
+    for(;j+7<=m && j+7<n;j+=8){
+      double d[8]={0.,0.,0.,0.,0.,0.,0.,0.};
+      __m128d a0,a1,a2,a3;
+      int k;
+
+      /* the first few samples only reach the shorter lags */
+      for(k=0;k<7;k++)
+        for(i=j+k;i<j+7;i++)d[k]+=dd[i]*dd[i-j-k];
+      /* lane 0 holds the odd lag of each pair */
+      a0=_mm_set_pd(d[0],d[1]);
+      a1=_mm_set_pd(d[2],d[3]);
+      a2=_mm_set_pd(d[4],d[5]);
+      a3=_mm_set_pd(d[6],d[7]);
+
+      for(i=j+7;i<n;i++){
+        const double *p=dd+i-j;
+        __m128d x=_mm_set1_pd(dd[i]);
+        a0=_mm_add_pd(a0,_mm_mul_pd(x,_mm_loadu_pd(p-1)));
+        a1=_mm_add_pd(a1,_mm_mul_pd(x,_mm_loadu_pd(p-3)));
+        a2=_mm_add_pd(a2,_mm_mul_pd(x,_mm_loadu_pd(p-5)));
+        a3=_mm_add_pd(a3,_mm_mul_pd(x,_mm_loadu_pd(p-7)));
+      }
+      _mm_storeh_pd(aut+j,a0);
+      _mm_storel_pd(aut+j+1,a0);
+      _mm_storeh_pd(aut+j+2,a1);
+      _mm_storel_pd(aut+j+3,a1);
+      _mm_storeh_pd(aut+j+4,a2);
+      _mm_storel_pd(aut+j+5,a2);
+      _mm_storeh_pd(aut+j+6,a3);
+      _mm_storel_pd(aut+j+7,a3);
+    }
+    _ogg_free(dd);
+  }
+#endif
+  for(;j<=m;j++){
     double d=0; /* double needed for accumulator depth */
     for(i=j;i<n;i++)d+=(double)data[i]*data[i-j];
     aut[j]=d;
@@ -137,9 +178,12 @@ void vorbis_lpc_predict(float *coeff,float *prime,int m,
          prime[0...m-1] initial values (allocated size of n+m-1)
     out: data[0...n-1] data samples */
 
-  long i,j,o,p;
+  long i,j,o,p,k=0;
   float y;
-  float *work=alloca(sizeof(*work)*(m+n));
+  /* only the last m outputs are needed; keep them in a window of 2m
+     that slides back whenever it fills, so the stack use doesn't
+     depend on n */
+  float *work=alloca(sizeof(*work)*(m*2));
 
   if(!prime)
     for(i=0;i<m;i++)
@@ -150,11 +194,15 @@ void vorbis_lpc_predict(float *coeff,float *prime,int m,
 
   for(i=0;i<n;i++){
     y=0;
-    o=i;
+    o=k;
     p=m;
     for(j=0;j<m;j++)
       y-=work[o++]*coeff[--p];
 
     data[i]=work[o]=y;
+    if(++k==m){
+      memcpy(work,work+m,m*sizeof(*work));
+      k=0;
+    }
   }
 }
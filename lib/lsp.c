@@ -62,10 +62,10 @@
                        modules */
 
 /* side effect: changes *lsp to cosines of lsp */
-void vorbis_lsp_to_curve(float *curve,int *map,int n,int ln,float *lsp,int m,
+void vorbis_lsp_to_curve(float *curve,int *map,const float *cosw,
+                            int n,float *lsp,int m,
                             float amp,float ampoffset){
   int i;
-  float wdel=M_PI/ln;
   vorbis_fpu_control fpu;
 
   vorbis_fpu_setround(&fpu);
@@ -77,7 +77,7 @@ void vorbis_lsp_to_curve(float *curve,int *map,int n,int ln,float *lsp,int m,
     int qexp;
     float p=.7071067812f;
     float q=.7071067812f;
-    float w=vorbis_coslook(wdel*k);
+    float w=.5f*cosw[k];
     float *ftmp=lsp;
     int c=m>>1;
 
@@ -137,7 +137,8 @@ static const int MLOOP_3[8]={0,1,2,2,3,3,3,3};
 
 
 /* side effect: changes *lsp to cosines of lsp */
-void vorbis_lsp_to_curve(float *curve,int *map,int n,int ln,float *lsp,int m,
+void vorbis_lsp_to_curve(float *curve,int *map,const float *cosw,
+                            int n,float *lsp,int m,
                             float amp,float ampoffset){
 
   /* 0 <= m < 256 */
@@ -155,7 +156,7 @@ void vorbis_lsp_to_curve(float *curve,int *map,int n,int ln,float *lsp,int m,
     unsigned long pi=46341; /* 2**-.5 in 0.16 */
     unsigned long qi=46341;
     int qexp=0,shift;
-    long wi=vorbis_coslook_i(k*65536/ln);
+    long wi=rint(cosw[k]*8192.f); /* cos in 0.14 */
 
     qi*=labs(ilsp[0]-wi);
     pi*=labs(ilsp[1]-wi);
@@ -244,19 +245,89 @@ void vorbis_lsp_to_curve(float *curve,int *map,int n,int ln,float *lsp,int m,
    figure out what the hell this code does, or wants the other
    fraction of a dB precision */
 
+#ifdef VORBIS_SSE2
+/* fromdB() of four values: 2^n scaled by a polynomial in the
+   remaining fraction; good to a few parts in 10^7 */
+static __m128 fromdB4(__m128 x){
+  __m128 t=_mm_mul_ps(x,_mm_set1_ps(.16609640f)); /* log2(e)/8.6858896 */
+  __m128 f,r;
+  __m128i e;
+
+  t=_mm_max_ps(_mm_min_ps(t,_mm_set1_ps(127.f)),_mm_set1_ps(-126.f));
+  e=_mm_cvtps_epi32(t);
+  f=_mm_sub_ps(t,_mm_cvtepi32_ps(e));
+
+  r=_mm_set1_ps(1.5403530e-4f);
+  r=_mm_add_ps(_mm_mul_ps(r,f),_mm_set1_ps(1.3333558e-3f));
+  r=_mm_add_ps(_mm_mul_ps(r,f),_mm_set1_ps(9.6181291e-3f));
+  r=_mm_add_ps(_mm_mul_ps(r,f),_mm_set1_ps(5.5504109e-2f));
+  r=_mm_add_ps(_mm_mul_ps(r,f),_mm_set1_ps(.24022651f));
+  r=_mm_add_ps(_mm_mul_ps(r,f),_mm_set1_ps(.69314718f));
+  r=_mm_add_ps(_mm_mul_ps(r,f),_mm_set1_ps(1.f));
+
+  e=_mm_slli_epi32(_mm_add_epi32(e,_mm_set1_epi32(127)),23);
+  return _mm_mul_ps(r,_mm_castsi128_ps(e));
+}
+#endif
+
 /* side effect: changes *lsp to cosines of lsp */
-void vorbis_lsp_to_curve(float *curve,int *map,int n,int ln,float *lsp,int m,
+void vorbis_lsp_to_curve(float *curve,int *map,const float *cosw,
+                            int n,float *lsp,int m,
                             float amp,float ampoffset){
   int i;
-  float wdel=M_PI/ln;
   for(i=0;i<m;i++)lsp[i]=2.f*cos(lsp[i]);
 
   i=0;
+#ifdef VORBIS_SSE2
+  /* the same evaluation for four distinct bins at a time */
+  while(i<n){
+    int j,l,lanes=0;
+    int start[4];
+    float w[4],q[4];
+    __m128 wv,pv,qv;
+
+    for(;lanes<4 && i<n;lanes++){
+      int k=map[i];
+      start[lanes]=i;
+      w[lanes]=cosw[k];
+      while(map[++i]==k);
+    }
+    for(l=lanes;l<4;l++)w[l]=0.f;
+
+    wv=_mm_loadu_ps(w);
+    pv=qv=_mm_set1_ps(.5f);
+    for(j=1;j<m;j+=2){
+      qv=_mm_mul_ps(qv,_mm_sub_ps(wv,_mm_set1_ps(lsp[j-1])));
+      pv=_mm_mul_ps(pv,_mm_sub_ps(wv,_mm_set1_ps(lsp[j])));
+    }
+    if(j==m){
+      /* odd order filter; slightly assymetric */
+      /* the last coefficient */
+      qv=_mm_mul_ps(qv,_mm_sub_ps(wv,_mm_set1_ps(lsp[j-1])));
+      pv=_mm_mul_ps(pv,_mm_mul_ps(pv,_mm_sub_ps(_mm_set1_ps(4.f),
+                                                _mm_mul_ps(wv,wv))));
+      qv=_mm_mul_ps(qv,qv);
+    }else{
+      /* even order filter; still symmetric */
+      pv=_mm_mul_ps(pv,_mm_mul_ps(pv,_mm_sub_ps(_mm_set1_ps(2.f),wv)));
+      qv=_mm_mul_ps(qv,_mm_mul_ps(qv,_mm_add_ps(_mm_set1_ps(2.f),wv)));
+    }
+    qv=_mm_div_ps(_mm_set1_ps(amp),_mm_sqrt_ps(_mm_add_ps(pv,qv)));
+    _mm_storeu_ps(q,fromdB4(_mm_sub_ps(qv,_mm_set1_ps(ampoffset))));
+
+    for(l=0;l<lanes;l++){
+      int k=start[l];
+      do
+        curve[k]*=q[l];
+      while(map[++k]==map[start[l]]);
+    }
+  }
+#endif
   while(i<n){
     int j,k=map[i];
     float p=.5f;
     float q=.5f;
-    float w=2.f*cos(wdel*k);
+    float w=cosw[k];
     for(j=1;j<m;j+=2){
       q *= w-lsp[j-1];
       p *= w-lsp[j];
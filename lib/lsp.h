@@ -21,8 +21,8 @@
 
 extern int vorbis_lpc_to_lsp(float *lpc,float *lsp,int m);
 
-extern void vorbis_lsp_to_curve(float *curve,int *map,int n,int ln,
-                                float *lsp,int m,
+extern void vorbis_lsp_to_curve(float *curve,int *map,const float *cosw,
+                                int n,float *lsp,int m,
                                 float amp,float ampoffset);
 
 #endif
@@ -234,40 +234,174 @@ static float FLOOR1_fromdB_LOOKUP[256]={
 
 #endif
 
-
-static int mapping0_forward(vorbis_block *vb){
+/* everything the packetblob encode needs from the analysis half of
+   mapping0_forward; lives in the block's local storage */
+typedef struct {
+  int                    modenumber;
+  vorbis_info_mapping0  *info;
+  vorbis_look_psy       *psy_look;
+  float                **gmdct;
+  int                  **iwork;
+  int                 ***floor_posts;
+} mapping0_blobs;
+
+/*
+  the next phases are performed once for vbr-only and PACKETBLOB
+  times for bitrate managed modes.
+
+  1) encode actual mode being used
+  2) encode the floor for each channel, compute coded mask curve/res
+  3) normalize and couple.
+  4) encode residue
+  5) save packet bytes to the packetblob vector
+
+  Each packetblob depends only on its own fits, so they may be
+  encoded in any order, on demand or concurrently given separate
+  iwork vectors and local storage (a NULL iwork uses the block's own).
+*/
+static int mapping0_blob(vorbis_block *vb,int k,int **iwork){
   vorbis_dsp_state      *vd=vb->vd;
   vorbis_info           *vi=vd->vi;
   codec_setup_info      *ci=vi->codec_setup;
-  private_state         *b=vb->vd->backend_state;
+  private_state         *b=vd->backend_state;
   vorbis_block_internal *vbi=(vorbis_block_internal *)vb->internal;
-  int                    n=vb->pcmend;
-  int i,j,k;
+  mapping0_blobs        *bs=vbi->blob_state;
+  vorbis_info_mapping0  *info=bs->info;
+  vorbis_look_psy       *psy_look=bs->psy_look;
+  int i,j;
+
+  int  *nonzero=alloca(sizeof(*nonzero)*vi->channels);
+  int **couple_bundle=alloca(sizeof(*couple_bundle)*vi->channels);
+  int  *zerobundle=alloca(sizeof(*zerobundle)*vi->channels);
+  oggpack_buffer *opb=vbi->packetblob[k];
+
+  if(!iwork)iwork=bs->iwork;
+
+  /* start out our new packet blob with packet type and mode */
+  /* Encode the packet type */
+  oggpack_write(opb,0,1);
+  /* Encode the modenumber */
+  /* Encode frame mode, pre,post windowsize, then dispatch */
+  oggpack_write(opb,bs->modenumber,b->modebits);
+  if(vb->W){
+    oggpack_write(opb,vb->lW,1);
+    oggpack_write(opb,vb->nW,1);
+  }
 
-  int    *nonzero    = alloca(sizeof(*nonzero)*vi->channels);
-  float  **gmdct     = _vorbis_block_alloc(vb,vi->channels*sizeof(*gmdct));
-  int    **iwork      = _vorbis_block_alloc(vb,vi->channels*sizeof(*iwork));
-  int ***floor_posts = _vorbis_block_alloc(vb,vi->channels*sizeof(*floor_posts));
+  /* encode floor, compute masking curve, sep out residue */
+  for(i=0;i<vi->channels;i++){
+    int submap=info->chmuxlist[i];
+    int *ilogmask=iwork[i];
 
-  float global_ampmax=vbi->ampmax;
-  float *local_ampmax=alloca(sizeof(*local_ampmax)*vi->channels);
-  int blocktype=vbi->blocktype;
+    nonzero[i]=floor1_encode(opb,vb,b->flr[info->floorsubmap[submap]],
+                             bs->floor_posts[i][k],
+                             ilogmask);
+#if 0
+    {
+      char buf[80];
+      sprintf(buf,"maskI%c%d",i?'R':'L',k);
+      float work[n/2];
+      for(j=0;j<n/2;j++)
+        work[j]=FLOOR1_fromdB_LOOKUP[iwork[i][j]];
+      _analysis_output(buf,seq,work,n/2,1,1,0);
+    }
+#endif
+  }
 
-  int modenumber=vb->W;
-  vorbis_info_mapping0 *info=ci->map_param[modenumber];
-  vorbis_look_psy *psy_look=b->psy+blocktype+(vb->W?2:0);
+  /* our iteration is now based on masking curve, not prequant and
+     coupling.  Only one prequant/coupling step */
+
+  /* quantize/couple */
+  /* incomplete implementation that assumes the tree is all depth
+     one, or no tree at all */
+  _vp_couple_quantize_normalize(k,
+                                &ci->psy_g_param,
+                                psy_look,
+                                info,
+                                bs->gmdct,
+                                iwork,
+                                nonzero,
+                                ci->psy_g_param.sliding_lowpass[vb->W][k],
+                                vi->channels);
 
-  vb->mode=modenumber;
+#if 0
+  for(i=0;i<vi->channels;i++){
+    char buf[80];
+    sprintf(buf,"res%c%d",i?'R':'L',k);
+    float work[n/2];
+    for(j=0;j<n/2;j++)
+      work[j]=iwork[i][j];
+    _analysis_output(buf,seq,work,n/2,1,0,0);
+  }
+#endif
+
+  /* classify and encode by submap */
+  for(i=0;i<info->submaps;i++){
+    int ch_in_bundle=0;
+    long **classifications;
+    int resnum=info->residuesubmap[i];
+
+    for(j=0;j<vi->channels;j++){
+      if(info->chmuxlist[j]==i){
+        zerobundle[ch_in_bundle]=0;
+        if(nonzero[j])zerobundle[ch_in_bundle]=1;
+        couple_bundle[ch_in_bundle++]=iwork[j];
+      }
+    }
+
+    classifications=_residue_P[ci->residue_type[resnum]]->
+      class(vb,b->residue[resnum],couple_bundle,zerobundle,ch_in_bundle);
+
+    ch_in_bundle=0;
+    for(j=0;j<vi->channels;j++)
+      if(info->chmuxlist[j]==i)
+        couple_bundle[ch_in_bundle++]=iwork[j];
+
+    _residue_P[ci->residue_type[resnum]]->
+      forward(opb,vb,b->residue[resnum],
+              couple_bundle,zerobundle,ch_in_bundle,classifications,i);
+  }
+
+  /* ok, done encoding.  Next protopacket. */
+  return(0);
+}
+
+/* the signal analysis of a block: windowing, transforms and log
+   spectra.  It depends only on the block decisions and the PCM, so a
+   block of another encoder following this block's decisions (see
+   vorbis_analysis_blockout_follow()) shares it rather than repeating
+   it.  It is never modified once made. */
+typedef struct {
+  float **mdct;
+  float **logfft;
+  float **logmdct;
+  float  *ampmax;   /* local amplitude maximum by channel */
+} mapping0_spectrum;
+
+static mapping0_spectrum *mapping0_analyze(vorbis_block *vb,int tone_mdct){
+  vorbis_dsp_state      *vd=vb->vd;
+  vorbis_info           *vi=vd->vi;
+  codec_setup_info      *ci=vi->codec_setup;
+  private_state         *b=vd->backend_state;
+  int                    n=vb->pcmend;
+  int i,j;
+
+  mapping0_spectrum *sp=_vorbis_block_alloc(vb,sizeof(*sp));
+  float *ampmax;
+
+  sp->mdct=_vorbis_block_alloc(vb,vi->channels*sizeof(*sp->mdct));
+  sp->logfft=_vorbis_block_alloc(vb,vi->channels*sizeof(*sp->logfft));
+  sp->logmdct=_vorbis_block_alloc(vb,vi->channels*sizeof(*sp->logmdct));
+  sp->ampmax=ampmax=_vorbis_block_alloc(vb,vi->channels*sizeof(*sp->ampmax));
 
   for(i=0;i<vi->channels;i++){
     float scale=4.f/n;
     float scale_dB;
 
     float *pcm     =vb->pcm[i];
-    float *logfft  =pcm;
-
-    iwork[i]=_vorbis_block_alloc(vb,n/2*sizeof(**iwork));
-    gmdct[i]=_vorbis_block_alloc(vb,n/2*sizeof(**gmdct));
+    float *logfft  =sp->logfft[i]=pcm;
+    float *mdct    =sp->mdct[i]=_vorbis_block_alloc(vb,n/2*sizeof(*mdct));
+    float *logmdct =sp->logmdct[i]=_vorbis_block_alloc(vb,n/2*sizeof(*logmdct));
 
     scale_dB=todB(&scale) + .345; /* + .345 is a hack; the original
                                      todB estimation used on IEEE 754
@@ -311,7 +445,36 @@ static int mapping0_forward(vorbis_block *vb){
 
     /* transform the PCM data */
     /* only MDCT right now.... */
-    mdct_forward(b->transform[vb->W][0],pcm,gmdct[i]);
+    mdct_forward(b->transform[vb->W][0],pcm,mdct);
+
+    for(j=0;j<n/2;j++)
+      logmdct[j]=todB(mdct+j)  + .345; /* + .345 is a hack; the original
+                                   todB estimation used on IEEE 754
+                                   compliant machines had a bug that
+                                   returned dB values about a third
+                                   of a decibel too high.  The bug
+                                   was harmless because tunings
+                                   implicitly took that into
+                                   account.  However, fixing the bug
+                                   in the estimator requires
+                                   changing all the tunings as well.
+                                   For now, it's easier to sync
+                                   things back up here, and
+                                   recalibrate the tunings in the
+                                   next major model upgrade. */
+
+    if(tone_mdct){
+      /* fast setting: take the tonal estimate from the MDCT (already
+         scaled by 4/n) and skip the FFT.  Both .345 offsets of the
+         FFT path below apply. */
+      ampmax[i]=-9999.f;
+      for(j=0;j<n/2;j++){
+        float temp=logfft[j]=todB(mdct+j)  + .345 + .345;
+        if(temp>ampmax[i])ampmax[i]=temp;
+      }
+      if(ampmax[i]>0.f)ampmax[i]=0.f;
+      continue;
+    }
 
     /* FFT yields more accurate tonal estimation (not phase sensitive) */
     drft_forward(&b->fft_look[vb->W],pcm);
@@ -329,7 +492,7 @@ static int mapping0_forward(vorbis_block *vb){
                                      things back up here, and
                                      recalibrate the tunings in the
                                      next major model upgrade. */
-    local_ampmax[i]=logfft[0];
+    ampmax[i]=logfft[0];
     for(j=1;j<n-1;j+=2){
       float temp=pcm[j]*pcm[j]+pcm[j+1]*pcm[j+1];
       temp=logfft[(j+1)>>1]=scale_dB+.5f*todB(&temp)  + .345; /* +
@@ -347,11 +510,10 @@ static int mapping0_forward(vorbis_block *vb){
                                      things back up here, and
                                      recalibrate the tunings in the
                                      next major model upgrade. */
-      if(temp>local_ampmax[i])local_ampmax[i]=temp;
+      if(temp>ampmax[i])ampmax[i]=temp;
     }
 
-    if(local_ampmax[i]>0.f)local_ampmax[i]=0.f;
-    if(local_ampmax[i]>global_ampmax)global_ampmax=local_ampmax[i];
+    if(ampmax[i]>0.f)ampmax[i]=0.f;
 
 #if 0
     if(vi->channels==2){
@@ -367,9 +529,48 @@ static int mapping0_forward(vorbis_block *vb){
 
   }
 
+  return(sp);
+}
+
+static int mapping0_forward(vorbis_block *vb){
+  vorbis_dsp_state      *vd=vb->vd;
+  vorbis_info           *vi=vd->vi;
+  codec_setup_info      *ci=vi->codec_setup;
+  private_state         *b=vb->vd->backend_state;
+  vorbis_block_internal *vbi=(vorbis_block_internal *)vb->internal;
+  int                    n=vb->pcmend;
+  int i,k;
+
+  float  **gmdct     = _vorbis_block_alloc(vb,vi->channels*sizeof(*gmdct));
+  int    **iwork      = _vorbis_block_alloc(vb,vi->channels*sizeof(*iwork));
+  int ***floor_posts = _vorbis_block_alloc(vb,vi->channels*sizeof(*floor_posts));
+
+  float global_ampmax=vbi->ampmax;
+  int blocktype=vbi->blocktype;
+
+  int modenumber=vb->W;
+  vorbis_info_mapping0 *info=ci->map_param[modenumber];
+  vorbis_look_psy *psy_look=b->psy+blocktype+(vb->W?2:0);
+  mapping0_spectrum *sp=vbi->spectrum;
+
+  vb->mode=modenumber;
+
+  if(!sp)
+    sp=vbi->spectrum=mapping0_analyze(vb,psy_look->vi->tone_mdct);
+
+  for(i=0;i<vi->channels;i++){
+    if(sp->ampmax[i]>global_ampmax)global_ampmax=sp->ampmax[i];
+
+    /* the psychoacoustics adjust the MDCT; work on a copy */
+    iwork[i]=_vorbis_block_alloc(vb,n/2*sizeof(**iwork));
+    gmdct[i]=_vorbis_block_alloc(vb,n/2*sizeof(**gmdct));
+    memcpy(gmdct[i],sp->mdct[i],n/2*sizeof(**gmdct));
+  }
+
   {
     float   *noise        = _vorbis_block_alloc(vb,n/2*sizeof(*noise));
     float   *tone         = _vorbis_block_alloc(vb,n/2*sizeof(*tone));
+    float   *logmask      = _vorbis_block_alloc(vb,n/2*sizeof(*logmask));
 
     for(i=0;i<vi->channels;i++){
       /* the encoder setup assumes that all the modes used by any
@@ -377,34 +578,15 @@ static int mapping0_forward(vorbis_block *vb){
 
       int submap=info->chmuxlist[i];
 
-      /* the following makes things clearer to *me* anyway */
       float *mdct    =gmdct[i];
-      float *logfft  =vb->pcm[i];
-
-      float *logmdct =logfft+n/2;
-      float *logmask =logfft;
+      float *logfft  =sp->logfft[i];
+      float *logmdct =sp->logmdct[i];
 
       vb->mode=modenumber;
 
       floor_posts[i]=_vorbis_block_alloc(vb,PACKETBLOBS*sizeof(**floor_posts));
       memset(floor_posts[i],0,sizeof(**floor_posts)*PACKETBLOBS);
 
-      for(j=0;j<n/2;j++)
-        logmdct[j]=todB(mdct+j)  + .345; /* + .345 is a hack; the original
-                                     todB estimation used on IEEE 754
-                                     compliant machines had a bug that
-                                     returned dB values about a third
-                                     of a decibel too high.  The bug
-                                     was harmless because tunings
-                                     implicitly took that into
-                                     account.  However, fixing the bug
-                                     in the estimator requires
-                                     changing all the tunings as well.
-                                     For now, it's easier to sync
-                                     things back up here, and
-                                     recalibrate the tunings in the
-                                     next major model upgrade. */
-
 #if 0
       if(vi->channels==2){
         if(i==0)
@@ -445,7 +627,7 @@ static int mapping0_forward(vorbis_block *vb){
                    logfft,
                    tone,
                    global_ampmax,
-                   local_ampmax[i]);
+                   sp->ampmax[i]);
 
 #if 0
       if(vi->channels==2){
@@ -583,124 +765,29 @@ static int mapping0_forward(vorbis_block *vb){
   }
   vbi->ampmax=global_ampmax;
 
-  /*
-    the next phases are performed once for vbr-only and PACKETBLOB
-    times for bitrate managed modes.
-
-    1) encode actual mode being used
-    2) encode the floor for each channel, compute coded mask curve/res
-    3) normalize and couple.
-    4) encode residue
-    5) save packet bytes to the packetblob vector
-
-  */
-
-  /* iterate over the many masking curve fits we've created */
-
   {
-    int **couple_bundle=alloca(sizeof(*couple_bundle)*vi->channels);
-    int *zerobundle=alloca(sizeof(*zerobundle)*vi->channels);
-
-    for(k=(vorbis_bitrate_managed(vb)?0:PACKETBLOBS/2);
-        k<=(vorbis_bitrate_managed(vb)?PACKETBLOBS-1:PACKETBLOBS/2);
-        k++){
-      oggpack_buffer *opb=vbi->packetblob[k];
-
-      /* start out our new packet blob with packet type and mode */
-      /* Encode the packet type */
-      oggpack_write(opb,0,1);
-      /* Encode the modenumber */
-      /* Encode frame mode, pre,post windowsize, then dispatch */
-      oggpack_write(opb,modenumber,b->modebits);
-      if(vb->W){
-        oggpack_write(opb,vb->lW,1);
-        oggpack_write(opb,vb->nW,1);
-      }
-
-      /* encode floor, compute masking curve, sep out residue */
-      for(i=0;i<vi->channels;i++){
-        int submap=info->chmuxlist[i];
-        int *ilogmask=iwork[i];
-
-        nonzero[i]=floor1_encode(opb,vb,b->flr[info->floorsubmap[submap]],
-                                 floor_posts[i][k],
-                                 ilogmask);
-#if 0
-        {
-          char buf[80];
-          sprintf(buf,"maskI%c%d",i?'R':'L',k);
-          float work[n/2];
-          for(j=0;j<n/2;j++)
-            work[j]=FLOOR1_fromdB_LOOKUP[iwork[i][j]];
-          _analysis_output(buf,seq,work,n/2,1,1,0);
-        }
-#endif
-      }
-
-      /* our iteration is now based on masking curve, not prequant and
-         coupling.  Only one prequant/coupling step */
-
-      /* quantize/couple */
-      /* incomplete implementation that assumes the tree is all depth
-         one, or no tree at all */
-      _vp_couple_quantize_normalize(k,
-                                    &ci->psy_g_param,
-                                    psy_look,
-                                    info,
-                                    gmdct,
-                                    iwork,
-                                    nonzero,
-                                    ci->psy_g_param.sliding_lowpass[vb->W][k],
-                                    vi->channels);
-
-#if 0
-      for(i=0;i<vi->channels;i++){
-        char buf[80];
-        sprintf(buf,"res%c%d",i?'R':'L',k);
-        float work[n/2];
-        for(j=0;j<n/2;j++)
-          work[j]=iwork[i][j];
-        _analysis_output(buf,seq,work,n/2,1,0,0);
-      }
-#endif
-
-      /* classify and encode by submap */
-      for(i=0;i<info->submaps;i++){
-        int ch_in_bundle=0;
-        long **classifications;
-        int resnum=info->residuesubmap[i];
-
-        for(j=0;j<vi->channels;j++){
-          if(info->chmuxlist[j]==i){
-            zerobundle[ch_in_bundle]=0;
-            if(nonzero[j])zerobundle[ch_in_bundle]=1;
-            couple_bundle[ch_in_bundle++]=iwork[j];
-          }
-        }
-
-        classifications=_residue_P[ci->residue_type[resnum]]->
-          class(vb,b->residue[resnum],couple_bundle,zerobundle,ch_in_bundle);
-
-        ch_in_bundle=0;
-        for(j=0;j<vi->channels;j++)
-          if(info->chmuxlist[j]==i)
-            couple_bundle[ch_in_bundle++]=iwork[j];
-
-        _residue_P[ci->residue_type[resnum]]->
-          forward(opb,vb,b->residue[resnum],
-                  couple_bundle,zerobundle,ch_in_bundle,classifications,i);
-      }
-
-      /* ok, done encoding.  Next protopacket. */
-    }
-
+    mapping0_blobs *bs=_vorbis_block_alloc(vb,sizeof(*bs));
+    bs->modenumber=modenumber;
+    bs->info=info;
+    bs->psy_look=psy_look;
+    bs->gmdct=gmdct;
+    bs->iwork=iwork;
+    bs->floor_posts=floor_posts;
+    vbi->blob_state=bs;
+    vbi->blob_encode=mapping0_blob;
   }
 
 #if 0
   seq++;
   total+=ci->blocksizes[vb->W]/4+ci->blocksizes[vb->nW]/4;
 #endif
-  return(0);
+
+  /* the packetblobs for bitrate management are left to the bitrate
+     manager, which may encode them all up front or only the ones it
+     ends up looking at */
+  if(vorbis_bitrate_managed(vb))
+    return(vorbis_bitrate_blobs(vb));
+  return(mapping0_blob(vb,PACKETBLOBS/2,NULL));
 }
 
 static int mapping0_inverse(vorbis_block *vb,vorbis_info_mapping *l){
@@ -164,6 +164,14 @@ static __inline void vorbis_fpu_restore(vorbis_fpu_control fpu){
 #endif /* Special MSVC x64 implementation */
 
 
+/* SSE2 is always present on x86_64; the vector loops elsewhere in the
+   library use it there and fall back to plain C everywhere else */
+#if (defined(_MSC_VER) && defined(_WIN64)) || (defined(__GNUC__) && defined(__SSE2__))
+#  define VORBIS_SSE2
+#  include <emmintrin.h>
+#endif
+
+
 /* If no special implementation was found for the current compiler / platform,
    use the default implementation here: */
 #ifndef VORBIS_FPU_CONTROL
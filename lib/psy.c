@@ -29,6 +29,10 @@
 #include "scales.h"
 #include "misc.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #define NEGINF -9999.f
 static const double stereo_threshholds[]={0.0, .5, 1.0, 1.5, 2.5, 4.5, 8.5, 16.5, 9e10};
 static const double stereo_threshholds_limited[]={0.0, .5, 1.0, 1.5, 2.0, 2.5, 4.5, 8.5, 9e10};
@@ -83,7 +87,7 @@ static void attenuate_curve(float *c,float att){
     c[i]+=att;
 }
 
-static float ***setup_tone_curves(float curveatt_dB[P_BANDS],float binHz,int n,
+static float ***setup_tone_curves(const float curveatt_dB[P_BANDS],float binHz,int n,
                                   float center_boost, float center_decay_rate){
   int i,j,k,m;
   float ath[EHMER_MAX];
@@ -264,31 +268,61 @@ static float ***setup_tone_curves(float curveatt_dB[P_BANDS],float binHz,int n,
   return(ret);
 }
 
-void _vp_psy_init(vorbis_look_psy *p,vorbis_info_psy *vi,
-                  vorbis_info_psy_global *gi,int n,long rate){
-  long i,j,lo=-99,hi=1;
-  long maxoc;
-  memset(p,0,sizeof(*p));
-
-  p->eighth_octave_lines=gi->eighth_octave_lines;
-  p->shiftoc=rint(log(gi->eighth_octave_lines*8.f)/log(2.f))-1;
+/* The ath, octave, bark, noise offset and tone curve lookups depend
+   only on a handful of psy settings, the blocksize and the rate.  They
+   take a while to build, so encoder instances with the same setup
+   share a single read-only copy.  Idle entries are kept around for a
+   while after their last user goes away so that back-to-back encodes
+   don't rebuild them; only the most recently used few are kept, and
+   vorbis_encode_cache_flush() frees them all. */
+
+#define PSY_TABLES_IDLE 8
+
+typedef struct {
+  int   n;
+  long  rate;
+  int   eighth_octave_lines;
+
+  float toneatt[P_BANDS];
+  float tone_centerboost;
+  float tone_decay;
+
+  float noisewindowlo;
+  float noisewindowhi;
+  int   noisewindowlomin;
+  int   noisewindowhimin;
+  float noiseoff[P_NOISECURVES][P_BANDS];
+} psy_tables_key;
+
+struct vorbis_psy_tables{
+  psy_tables_key key;
+
+  float ***tonecurves;
+  float **noiseoffset;
+  float  *ath;
+  long   *octave;
+  long   *bark;
+
+  int refcount;
+  struct vorbis_psy_tables *next;
+};
 
-  p->firstoc=toOC(.25f*rate*.5/n)*(1<<(p->shiftoc+1))-gi->eighth_octave_lines;
-  maxoc=toOC((n+.25f)*rate*.5/n)*(1<<(p->shiftoc+1))+.5f;
-  p->total_octave_lines=maxoc-p->firstoc+1;
-  p->ath=_ogg_malloc(n*sizeof(*p->ath));
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t psy_tables_lock=PTHREAD_MUTEX_INITIALIZER;
+static vorbis_psy_tables *psy_tables_list=NULL;
+#endif
 
-  p->octave=_ogg_malloc(n*sizeof(*p->octave));
-  p->bark=_ogg_malloc(n*sizeof(*p->bark));
-  p->vi=vi;
-  p->n=n;
-  p->rate=rate;
+static vorbis_psy_tables *psy_tables_build(const psy_tables_key *key,
+                                           long shiftoc){
+  vorbis_psy_tables *t=_ogg_calloc(1,sizeof(*t));
+  long i,j,lo=-99,hi=1;
+  int n=key->n;
+  long rate=key->rate;
 
-  /* AoTuV HF weighting */
-  p->m_val = 1.;
-  if(rate < 26000) p->m_val = 0;
-  else if(rate < 38000) p->m_val = .94;   /* 32kHz */
-  else if(rate > 46000) p->m_val = 1.275; /* 48kHz */
+  t->key=*key;
+  t->ath=_ogg_malloc(n*sizeof(*t->ath));
+  t->octave=_ogg_malloc(n*sizeof(*t->octave));
+  t->bark=_ogg_malloc(n*sizeof(*t->bark));
 
   /* set up the lookups for a given blocksize and sample rate */
 
@@ -298,39 +332,39 @@ void _vp_psy_init(vorbis_look_psy *p,vorbis_info_psy *vi,
     if(j<endpos){
       float delta=(ATH[i+1]-base)/(endpos-j);
       for(;j<endpos && j<n;j++){
-        p->ath[j]=base+100.;
+        t->ath[j]=base+100.;
         base+=delta;
       }
     }
   }
 
   for(;j<n;j++){
-    p->ath[j]=p->ath[j-1];
+    t->ath[j]=t->ath[j-1];
   }
 
   for(i=0;i<n;i++){
     float bark=toBARK(rate/(2*n)*i);
 
-    for(;lo+vi->noisewindowlomin<i &&
-          toBARK(rate/(2*n)*lo)<(bark-vi->noisewindowlo);lo++);
+    for(;lo+key->noisewindowlomin<i &&
+          toBARK(rate/(2*n)*lo)<(bark-key->noisewindowlo);lo++);
 
-    for(;hi<=n && (hi<i+vi->noisewindowhimin ||
-          toBARK(rate/(2*n)*hi)<(bark+vi->noisewindowhi));hi++);
+    for(;hi<=n && (hi<i+key->noisewindowhimin ||
+          toBARK(rate/(2*n)*hi)<(bark+key->noisewindowhi));hi++);
 
-    p->bark[i]=((lo-1)<<16)+(hi-1);
+    t->bark[i]=((lo-1)<<16)+(hi-1);
 
   }
 
   for(i=0;i<n;i++)
-    p->octave[i]=toOC((i+.25f)*.5*rate/n)*(1<<(p->shiftoc+1))+.5f;
+    t->octave[i]=toOC((i+.25f)*.5*rate/n)*(1<<(shiftoc+1))+.5f;
 
-  p->tonecurves=setup_tone_curves(vi->toneatt,rate*.5/n,n,
-                                  vi->tone_centerboost,vi->tone_decay);
+  t->tonecurves=setup_tone_curves(key->toneatt,rate*.5/n,n,
+                                  key->tone_centerboost,key->tone_decay);
 
   /* set up rolling noise median */
-  p->noiseoffset=_ogg_malloc(P_NOISECURVES*sizeof(*p->noiseoffset));
+  t->noiseoffset=_ogg_malloc(P_NOISECURVES*sizeof(*t->noiseoffset));
   for(i=0;i<P_NOISECURVES;i++)
-    p->noiseoffset[i]=_ogg_malloc(n*sizeof(**p->noiseoffset));
+    t->noiseoffset[i]=_ogg_malloc(n*sizeof(**t->noiseoffset));
 
   for(i=0;i<n;i++){
     float halfoc=toOC((i+.5)*rate/(2.*n))*2.;
@@ -343,42 +377,202 @@ void _vp_psy_init(vorbis_look_psy *p,vorbis_info_psy *vi,
     del=halfoc-inthalfoc;
 
     for(j=0;j<P_NOISECURVES;j++)
-      p->noiseoffset[j][i]=
-        p->vi->noiseoff[j][inthalfoc]*(1.-del) +
-        p->vi->noiseoff[j][inthalfoc+1]*del;
+      t->noiseoffset[j][i]=
+        key->noiseoff[j][inthalfoc]*(1.-del) +
+        key->noiseoff[j][inthalfoc+1]*del;
 
   }
 #if 0
   {
     static int ls=0;
-    _analysis_output_always("noiseoff0",ls,p->noiseoffset[0],n,1,0,0);
-    _analysis_output_always("noiseoff1",ls,p->noiseoffset[1],n,1,0,0);
-    _analysis_output_always("noiseoff2",ls++,p->noiseoffset[2],n,1,0,0);
+    _analysis_output_always("noiseoff0",ls,t->noiseoffset[0],n,1,0,0);
+    _analysis_output_always("noiseoff1",ls,t->noiseoffset[1],n,1,0,0);
+    _analysis_output_always("noiseoff2",ls++,t->noiseoffset[2],n,1,0,0);
   }
 #endif
+
+  t->refcount=1;
+  return t;
 }
 
-void _vp_psy_clear(vorbis_look_psy *p){
+static void psy_tables_free(vorbis_psy_tables *t){
   int i,j;
-  if(p){
-    if(p->ath)_ogg_free(p->ath);
-    if(p->octave)_ogg_free(p->octave);
-    if(p->bark)_ogg_free(p->bark);
-    if(p->tonecurves){
-      for(i=0;i<P_BANDS;i++){
-        for(j=0;j<P_LEVELS;j++){
-          _ogg_free(p->tonecurves[i][j]);
-        }
-        _ogg_free(p->tonecurves[i]);
+  if(t->tonecurves){
+    for(i=0;i<P_BANDS;i++){
+      for(j=0;j<P_LEVELS;j++){
+        _ogg_free(t->tonecurves[i][j]);
       }
-      _ogg_free(p->tonecurves);
+      _ogg_free(t->tonecurves[i]);
     }
-    if(p->noiseoffset){
-      for(i=0;i<P_NOISECURVES;i++){
-        _ogg_free(p->noiseoffset[i]);
+    _ogg_free(t->tonecurves);
+  }
+  if(t->noiseoffset){
+    for(i=0;i<P_NOISECURVES;i++){
+      _ogg_free(t->noiseoffset[i]);
+    }
+    _ogg_free(t->noiseoffset);
+  }
+  if(t->ath)_ogg_free(t->ath);
+  if(t->octave)_ogg_free(t->octave);
+  if(t->bark)_ogg_free(t->bark);
+  memset(t,0,sizeof(*t));
+  _ogg_free(t);
+}
+
+static vorbis_psy_tables *psy_tables_get(const psy_tables_key *key,
+                                         long shiftoc){
+#ifdef HAVE_PTHREAD
+  vorbis_psy_tables *t;
+
+  pthread_mutex_lock(&psy_tables_lock);
+  for(t=psy_tables_list;t;t=t->next)
+    if(!memcmp(&t->key,key,sizeof(*key)))break;
+
+  if(t){
+    t->refcount++;
+  }else{
+    t=psy_tables_build(key,shiftoc);
+    t->next=psy_tables_list;
+    psy_tables_list=t;
+  }
+  pthread_mutex_unlock(&psy_tables_lock);
+  return t;
+#else
+  /* no locking available; every look gets a private copy */
+  return psy_tables_build(key,shiftoc);
+#endif
+}
+
+static void psy_tables_release(vorbis_psy_tables *t){
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&psy_tables_lock);
+  if(--t->refcount==0){
+    vorbis_psy_tables **p=&psy_tables_list;
+    vorbis_psy_tables *oldest=NULL;
+    int idle=0;
+
+    /* move to the head of the list; the idle entry nearest the tail
+       is the one that has been unused longest */
+    while(*p!=t)p=&(*p)->next;
+    *p=t->next;
+    t->next=psy_tables_list;
+    psy_tables_list=t;
+
+    for(t=psy_tables_list;t;t=t->next)
+      if(t->refcount==0){
+        idle++;
+        oldest=t;
       }
-      _ogg_free(p->noiseoffset);
+
+    if(idle>PSY_TABLES_IDLE){
+      p=&psy_tables_list;
+      while(*p!=oldest)p=&(*p)->next;
+      *p=oldest->next;
+      psy_tables_free(oldest);
     }
+  }
+  pthread_mutex_unlock(&psy_tables_lock);
+#else
+  if(--t->refcount==0)
+    psy_tables_free(t);
+#endif
+}
+
+/* frees every idle entry; those in use are left to their users */
+void _vp_psy_tables_flush(void){
+#ifdef HAVE_PTHREAD
+  vorbis_psy_tables **p=&psy_tables_list;
+  vorbis_psy_tables *t;
+
+  pthread_mutex_lock(&psy_tables_lock);
+  while((t=*p)){
+    if(t->refcount==0){
+      *p=t->next;
+      psy_tables_free(t);
+    }else
+      p=&t->next;
+  }
+  pthread_mutex_unlock(&psy_tables_lock);
+#endif
+}
+
+static void psy_tables_key_init(psy_tables_key *key,vorbis_info_psy *vi,
+                                vorbis_info_psy_global *gi,int n,long rate){
+  /* zeroed so that padding compares equal */
+  memset(key,0,sizeof(*key));
+  key->n=n;
+  key->rate=rate;
+  key->eighth_octave_lines=gi->eighth_octave_lines;
+  memcpy(key->toneatt,vi->toneatt,sizeof(key->toneatt));
+  key->tone_centerboost=vi->tone_centerboost;
+  key->tone_decay=vi->tone_decay;
+  key->noisewindowlo=vi->noisewindowlo;
+  key->noisewindowhi=vi->noisewindowhi;
+  key->noisewindowlomin=vi->noisewindowlomin;
+  key->noisewindowhimin=vi->noisewindowhimin;
+  memcpy(key->noiseoff,vi->noiseoff,sizeof(key->noiseoff));
+}
+
+static long psy_shiftoc(vorbis_info_psy_global *gi){
+  return rint(log(gi->eighth_octave_lines*8.f)/log(2.f))-1;
+}
+
+/* a reference to the tables _vp_psy_init() would use, for a frozen
+   configuration to hold on to; NULL where tables aren't shared */
+vorbis_psy_tables *_vp_psy_tables_pin(vorbis_info_psy *vi,
+                                      vorbis_info_psy_global *gi,
+                                      int n,long rate){
+#ifdef HAVE_PTHREAD
+  psy_tables_key key;
+  psy_tables_key_init(&key,vi,gi,n,rate);
+  return psy_tables_get(&key,psy_shiftoc(gi));
+#else
+  return NULL;
+#endif
+}
+
+void _vp_psy_tables_unpin(vorbis_psy_tables *t){
+  if(t)psy_tables_release(t);
+}
+
+void _vp_psy_init(vorbis_look_psy *p,vorbis_info_psy *vi,
+                  vorbis_info_psy_global *gi,int n,long rate){
+  long maxoc;
+  psy_tables_key key;
+  memset(p,0,sizeof(*p));
+
+  p->eighth_octave_lines=gi->eighth_octave_lines;
+  p->shiftoc=psy_shiftoc(gi);
+
+  p->firstoc=toOC(.25f*rate*.5/n)*(1<<(p->shiftoc+1))-gi->eighth_octave_lines;
+  maxoc=toOC((n+.25f)*rate*.5/n)*(1<<(p->shiftoc+1))+.5f;
+  p->total_octave_lines=maxoc-p->firstoc+1;
+
+  p->vi=vi;
+  p->n=n;
+  p->rate=rate;
+
+  /* AoTuV HF weighting */
+  p->m_val = 1.;
+  if(rate < 26000) p->m_val = 0;
+  else if(rate < 38000) p->m_val = .94;   /* 32kHz */
+  else if(rate > 46000) p->m_val = 1.275; /* 48kHz */
+
+  psy_tables_key_init(&key,vi,gi,n,rate);
+  p->tables=psy_tables_get(&key,p->shiftoc);
+  p->ath=p->tables->ath;
+  p->octave=p->tables->octave;
+  p->bark=p->tables->bark;
+  p->tonecurves=(const float ***)p->tables->tonecurves;
+  p->noiseoffset=(const float **)p->tables->noiseoffset;
+
+  p->work=_ogg_malloc(n*6*sizeof(*p->work));
+}
+
+void _vp_psy_clear(vorbis_look_psy *p){
+  if(p){
+    if(p->tables)psy_tables_release(p->tables);
+    if(p->work)_ogg_free(p->work);
     memset(p,0,sizeof(*p));
   }
 }
@@ -411,18 +605,73 @@ static void seed_curve(float *seed,
   }
 }
 
+/* As above, but the seed vector is stored phase-major: seed line s
+   lives at rows[(s&(linesper-1))*rowlen + (s>>lineshift)].  A curve
+   lands on every linesper'th line, so in this layout it becomes one
+   contiguous run and can be applied with a vector max.  The lines
+   touched are exactly those seed_curve() touches. */
+static void seed_curve_phased(float *rows,long rowlen,int lineshift,
+                              const float **curves,
+                              float amp,
+                              int oc, int n,
+                              int linesper,float dBoffset){
+  int i,lo,hi,post0,post1;
+  int seedptr,phase;
+  const float *posts,*curve;
+  float *row;
+
+  int choice=(int)((amp+dBoffset-P_LEVEL_0)*.1f);
+  choice=max(choice,0);
+  choice=min(choice,P_LEVELS-1);
+  posts=curves[choice];
+  curve=posts+2;
+  post0=(int)posts[0];
+  post1=(int)posts[1];
+  seedptr=oc+(post0-EHMER_OFFSET)*linesper-(linesper>>1);
+
+  /* seed_curve() skips lines <=0 and stops at the first line >=n */
+  lo=post0;
+  if(seedptr<=0)lo+=(linesper-seedptr)>>lineshift;
+  hi=post0+((n-seedptr+linesper-1)>>lineshift);
+  if(hi>post1)hi=post1;
+  if(lo>=hi)return;
+
+  phase=seedptr&(linesper-1);
+  row=rows+phase*rowlen+(seedptr-phase)/linesper+(lo-post0);
+  curve+=lo;
+  hi-=lo;
+
+  i=0;
+#ifdef VORBIS_SSE2
+  {
+    __m128 a=_mm_set1_ps(amp);
+    for(;i+4<=hi;i+=4){
+      __m128 lin=_mm_add_ps(a,_mm_loadu_ps(curve+i));
+      _mm_storeu_ps(row+i,_mm_max_ps(lin,_mm_loadu_ps(row+i)));
+    }
+  }
+#endif
+  for(;i<hi;i++){
+    float lin=amp+curve[i];
+    if(row[i]<lin)row[i]=lin;
+  }
+}
+
 static void seed_loop(vorbis_look_psy *p,
                       const float ***curves,
                       const float *f,
                       const float *flr,
                       float *seed,
+                      long rowlen,
+                      int lineshift,
                       float specmax){
   vorbis_info_psy *vi=p->vi;
-  long n=p->n,i;
+  long n=p->n,i,k,lines=0;
   float dBoffset=vi->max_curve_dB-specmax;
+  long *lineend=(long *)p->work;
+  float *linemax=(float *)(lineend+n);
 
-  /* prime the working vector with peak values */
-
+  /* peak value of each octave line */
   for(i=0;i<n;i++){
     float max=f[i];
     long oc=p->octave[i];
@@ -430,20 +679,45 @@ static void seed_loop(vorbis_look_psy *p,
       i++;
       if(f[i]>max)max=f[i];
     }
+    linemax[lines]=max;
+    lineend[lines++]=i;
+  }
+
+  /* prime the working vector with peak values */
+
+  for(k=0;k<lines;k++){
+    float max=linemax[k];
+    long oc;
+    i=lineend[k];
+
+    /* fast setting: a line below either neighbour is nearly always
+       masked by the neighbour's curve, so only seed local peaks */
+    if(vi->tone_peaks &&
+       ((k>0 && max<linemax[k-1]) || (k+1<lines && max<linemax[k+1])))
+      continue;
 
     if(max+6.f>flr[i]){
-      oc=oc>>p->shiftoc;
+      oc=p->octave[i]>>p->shiftoc;
 
       if(oc>=P_BANDS)oc=P_BANDS-1;
       if(oc<0)oc=0;
 
-      seed_curve(seed,
-                 curves[oc],
-                 max,
-                 p->octave[i]-p->firstoc,
-                 p->total_octave_lines,
-                 p->eighth_octave_lines,
-                 dBoffset);
+      if(rowlen)
+        seed_curve_phased(seed,rowlen,lineshift,
+                          curves[oc],
+                          max,
+                          p->octave[i]-p->firstoc,
+                          p->total_octave_lines,
+                          p->eighth_octave_lines,
+                          dBoffset);
+      else
+        seed_curve(seed,
+                   curves[oc],
+                   max,
+                   p->octave[i]-p->firstoc,
+                   p->total_octave_lines,
+                   p->eighth_octave_lines,
+                   dBoffset);
     }
   }
 }
@@ -541,17 +815,19 @@ static void max_seeds(vorbis_look_psy *p,
 
 }
 
+/* work is 5*n floats */
 static void bark_noise_hybridmp(int n,const long *b,
                                 const float *f,
                                 float *noise,
                                 const float offset,
-                                const int fixed){
+                                const int fixed,
+                                float *work){
 
-  float *N=alloca(n*sizeof(*N));
-  float *X=alloca(n*sizeof(*N));
-  float *XX=alloca(n*sizeof(*N));
-  float *Y=alloca(n*sizeof(*N));
-  float *XY=alloca(n*sizeof(*N));
+  float *N=work;
+  float *X=N+n;
+  float *XX=X+n;
+  float *Y=XX+n;
+  float *XY=Y+n;
 
   float tN, tX, tXX, tY, tXY;
   int i;
@@ -701,15 +977,15 @@ void _vp_noisemask(vorbis_look_psy *p,
                    float *logmask){
 
   int i,n=p->n;
-  float *work=alloca(n*sizeof(*work));
+  float *work=p->work;
 
   bark_noise_hybridmp(n,p->bark,logmdct,logmask,
-                      140.,-1);
+                      140.,-1,work+n);
 
   for(i=0;i<n;i++)work[i]=logmdct[i]-logmask[i];
 
   bark_noise_hybridmp(n,p->bark,work,logmask,0.,
-                      p->vi->noisewindowfixed);
+                      p->vi->noisewindowfixed,work+n);
 
   for(i=0;i<n;i++)work[i]=logmdct[i]-work[i];
 
@@ -751,10 +1027,11 @@ void _vp_tonemask(vorbis_look_psy *p,
                   float local_specmax){
 
   int i,n=p->n;
+  long lines=p->total_octave_lines;
+  int linesper=p->eighth_octave_lines;
 
-  float *seed=alloca(sizeof(*seed)*p->total_octave_lines);
+  float *seed=alloca(sizeof(*seed)*lines);
   float att=local_specmax+p->vi->ath_adjatt;
-  for(i=0;i<p->total_octave_lines;i++)seed[i]=NEGINF;
 
   /* set the ATH (floating below localmax, not global max by a
      specified att) */
@@ -764,7 +1041,25 @@ void _vp_tonemask(vorbis_look_psy *p,
     logmask[i]=p->ath[i]+att;
 
   /* tone masking */
-  seed_loop(p,(const float ***)p->tonecurves,logfft,logmask,seed,global_specmax);
+  if(linesper>0 && !(linesper&(linesper-1))){
+    /* seed in phase-major order, then put the lines back in order */
+    long rowlen=(lines+linesper-1)/linesper;
+    float *rows=alloca(sizeof(*rows)*rowlen*linesper);
+    int lineshift=0,j;
+    while((1<<lineshift)<linesper)lineshift++;
+
+    for(i=0;i<rowlen*linesper;i++)rows[i]=NEGINF;
+    seed_loop(p,p->tonecurves,logfft,logmask,rows,rowlen,lineshift,
+              global_specmax);
+    for(j=0;j<linesper;j++){
+      float *row=rows+j*rowlen;
+      for(i=0;j+(i<<lineshift)<lines;i++)
+        seed[j+(i<<lineshift)]=row[i];
+    }
+  }else{
+    for(i=0;i<lines;i++)seed[i]=NEGINF;
+    seed_loop(p,p->tonecurves,logfft,logmask,seed,0,0,global_specmax);
+  }
   max_seeds(p,seed,logmask);
 
 }
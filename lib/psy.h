@@ -61,6 +61,10 @@ typedef struct vorbis_info_psy{
   int normal_start;
   int normal_partition;
   double normal_thresh;
+
+  /* encoder speed settings (OV_ECTL_SPEED_SET) */
+  int tone_peaks; /* seed tone masking only from local spectral peaks */
+  int tone_mdct;  /* estimate tonality from the MDCT; no separate FFT */
 } vorbis_info_psy;
 
 typedef struct{
@@ -81,6 +85,8 @@ typedef struct{
   int   coupling_postpointamp[PACKETBLOBS];
   int   sliding_lowpass[2][PACKETBLOBS];
 
+  int   envelope_mix; /* speed setting: one detector on the channel mix */
+
 } vorbis_info_psy_global;
 
 typedef struct {
@@ -92,16 +98,21 @@ typedef struct {
 } vorbis_look_psy_global;
 
 
+typedef struct vorbis_psy_tables vorbis_psy_tables;
+
 typedef struct {
   int n;
   struct vorbis_info_psy *vi;
 
-  float ***tonecurves;
-  float **noiseoffset;
+  /* read-only lookups below are shared between encoder instances */
+  vorbis_psy_tables *tables;
+
+  const float ***tonecurves;
+  const float **noiseoffset;
 
-  float *ath;
-  long  *octave;             /* in n.ocshift format */
-  long  *bark;
+  const float *ath;
+  const long  *octave;       /* in n.ocshift format */
+  const long  *bark;
 
   long  firstoc;
   long  shiftoc;
@@ -111,11 +122,17 @@ typedef struct {
 
   float m_val; /* Masking compensation value */
 
+  float *work; /* 6*n floats of scratch for the per-block masking */
 } vorbis_look_psy;
 
 extern void   _vp_psy_init(vorbis_look_psy *p,vorbis_info_psy *vi,
                            vorbis_info_psy_global *gi,int n,long rate);
 extern void   _vp_psy_clear(vorbis_look_psy *p);
+extern void   _vp_psy_tables_flush(void);
+extern vorbis_psy_tables *_vp_psy_tables_pin(vorbis_info_psy *vi,
+                                             vorbis_info_psy_global *gi,
+                                             int n,long rate);
+extern void   _vp_psy_tables_unpin(vorbis_psy_tables *t);
 extern void  *_vi_psy_dup(void *source);
 
 extern void   _vi_psy_free(vorbis_info_psy *i);
@@ -66,6 +66,9 @@ typedef struct {
 
 } vorbis_look_residue0;
 
+/* for vorbis_synthesis_headercheck() */
+const int res0_look_size=sizeof(vorbis_look_residue0);
+
 void res0_free_info(vorbis_info_residue *i){
   vorbis_info_residue0 *info=(vorbis_info_residue0 *)i;
   if(info){
@@ -326,89 +329,149 @@ vorbis_look_residue *res0_look(vorbis_dsp_state *vd,
 }
 
 /* break an abstraction and copy some code for performance purposes */
-static int local_book_besterror(codebook *book,int *a){
+
+/* nearest populated entry to a; only needed when the lattice
+   quantization below lands on an unused entry of a sparse book */
+static int local_book_nearest(codebook *book,int *a,int *p){
   int dim=book->dim;
-  int i,j,o;
+  int i,j,index=-1;
+  /* scan only the populated entries (collected at book init), in
+     entry order so ties still go to the lowest entry; stop summing
+     an entry's error as soon as it can't beat the best so far */
+  const int *e=book->enc_vals;
+  int best=-1;
+  for(i=0;i<book->enc_used;i++,e+=dim){
+    int this=0;
+    for(j=0;j<dim;j++){
+      int val=(e[j]-a[j]);
+      this+=val*val;
+      if(best!=-1 && this>=best)break;
+    }
+    if(j==dim){
+      memcpy(p,e,dim*sizeof(*e));
+      best=this;
+      index=book->enc_index[i];
+    }
+  }
+  return(index);
+}
+
+/* quantize a run of vectors against the same book in one go; the
+   chosen entries land in ent[] and the residual is left in vec */
+static void local_book_besterrorv(codebook *book,int *vec,int step,int *ent){
+  int dim=book->dim;
+  int i,o,s;
   int minval=book->minval;
   int del=book->delta;
   int qv=book->quantvals;
   int ze=(qv>>1);
-  int index=0;
+  const long *lengthlist=book->c->lengthlist;
   /* assumes integer/centered encoder codebook maptype 1 no more than dim 8 */
   int p[8]={0,0,0,0,0,0,0,0};
 
-  if(del!=1){
-    for(i=0,o=dim;i<dim;i++){
-      int v = (a[--o]-minval+(del>>1))/del;
-      int m = (v<ze ? ((ze-v)<<1)-1 : ((v-ze)<<1));
-      index = index*qv+ (m<0?0:(m>=qv?qv-1:m));
-      p[o]=v*del+minval;
-    }
-  }else{
-    for(i=0,o=dim;i<dim;i++){
-      int v = a[--o]-minval;
-      int m = (v<ze ? ((ze-v)<<1)-1 : ((v-ze)<<1));
-      index = index*qv+ (m<0?0:(m>=qv?qv-1:m));
-      p[o]=v*del+minval;
-    }
-  }
+  if(del==1){
+    /* the lattice point is the vector itself unless the entry is
+       unused, so the residual is zero */
+    for(s=0;s<step;s++,vec+=dim){
+      int index=0;
+      for(i=0,o=dim;i<dim;i++){
+        int v = vec[--o]-minval;
+        int m = (v<ze ? ((ze-v)<<1)-1 : ((v-ze)<<1));
+        index = index*qv+ (m<0?0:(m>=qv?qv-1:m));
+      }
 
-  if(book->c->lengthlist[index]<=0){
-    const static_codebook *c=book->c;
-    int best=-1;
-    /* assumes integer/centered encoder codebook maptype 1 no more than dim 8 */
-    int e[8]={0,0,0,0,0,0,0,0};
-    int maxval = book->minval + book->delta*(book->quantvals-1);
-    for(i=0;i<book->entries;i++){
-      if(c->lengthlist[i]>0){
-        int this=0;
-        for(j=0;j<dim;j++){
-          int val=(e[j]-a[j]);
-          this+=val*val;
-        }
-        if(best==-1 || this<best){
-          memcpy(p,e,sizeof(p));
-          best=this;
-          index=i;
+      if(lengthlist[index]>0){
+        for(i=0;i<dim;i++)
+          vec[i]=0;
+      }else{
+        int best=local_book_nearest(book,vec,p);
+        if(best>-1){
+          index=best;
+          for(i=0;i<dim;i++)
+            vec[i]-=p[i];
+        }else{
+          for(i=0;i<dim;i++)
+            vec[i]=0;
         }
       }
-      /* assumes the value patterning created by the tools in vq/ */
-      j=0;
-      while(e[j]>=maxval)
-        e[j++]=0;
-      if(e[j]>=0)
-        e[j]+=book->delta;
-      e[j]= -e[j];
+      ent[s]=index;
     }
-  }
+  }else{
+    for(s=0;s<step;s++,vec+=dim){
+      int index=0;
+      for(i=0,o=dim;i<dim;i++){
+        int v = (vec[--o]-minval+(del>>1))/del;
+        int m = (v<ze ? ((ze-v)<<1)-1 : ((v-ze)<<1));
+        index = index*qv+ (m<0?0:(m>=qv?qv-1:m));
+        p[o]=v*del+minval;
+      }
 
-  if(index>-1){
-    for(i=0;i<dim;i++)
-      *a++ -= p[i];
-  }
+      if(lengthlist[index]<=0){
+        int best=local_book_nearest(book,vec,p);
+        if(best>-1)index=best;
+      }
 
-  return(index);
+      for(i=0;i<dim;i++)
+        vec[i]-=p[i];
+      ent[s]=index;
+    }
+  }
 }
 
 static int _encodepart(oggpack_buffer *opb,int *vec, int n,
                        codebook *book,long *acc){
-  int i,bits=0;
   int dim=book->dim;
   int step=n/dim;
+  int *ent=alloca(step*sizeof(*ent));
 
-  for(i=0;i<step;i++){
-    int entry=local_book_besterror(book,vec+i*dim);
+  local_book_besterrorv(book,vec,step,ent);
 
 #ifdef TRAIN_RES
-    if(entry>=0)
-      acc[entry]++;
+  {
+    int i;
+    for(i=0;i<step;i++)
+      if(ent[i]>=0)
+        acc[ent[i]]++;
+  }
 #endif
 
-    bits+=vorbis_book_encode(book,entry,opb);
+  return(vorbis_book_encodev(book,ent,step,opb));
+}
 
+/* maximum and sum of magnitudes of each of a run of equally sized
+   partitions, in one pass.  ent may be NULL. */
+static void _partstats(const int *in,int parts,int size,int *max,int *ent){
+  int i,k;
+  for(i=0;i<parts;i++,in+=size){
+    int m=0,e=0;
+    k=0;
+#ifdef VORBIS_SSE2
+    if(size>=4){
+      __m128i vm=_mm_setzero_si128();
+      __m128i ve=_mm_setzero_si128();
+      int t[4];
+      for(;k+4<=size;k+=4){
+        __m128i x=_mm_loadu_si128((const __m128i *)(in+k));
+        __m128i s=_mm_srai_epi32(x,31);
+        x=_mm_sub_epi32(_mm_xor_si128(x,s),s);
+        ve=_mm_add_epi32(ve,x);
+        s=_mm_cmpgt_epi32(x,vm);
+        vm=_mm_or_si128(_mm_and_si128(s,x),_mm_andnot_si128(s,vm));
+      }
+      _mm_storeu_si128((__m128i *)t,vm);
+      m=max(max(t[0],t[1]),max(t[2],t[3]));
+      _mm_storeu_si128((__m128i *)t,ve);
+      e=t[0]+t[1]+t[2]+t[3];
+    }
+#endif
+    for(;k<size;k++){
+      int v=abs(in[k]);
+      if(v>m)m=v;
+      e+=v;
+    }
+    max[i]=m;
+    if(ent)ent[i]=e;
   }
-
-  return(bits);
 }
 
 static long **_01class(vorbis_block *vb,vorbis_look_residue *vl,
@@ -435,23 +498,26 @@ static long **_01class(vorbis_block *vb,vorbis_look_residue *vl,
     memset(partword[i],0,n/samples_per_partition*sizeof(*partword[i]));
   }
 
-  for(i=0;i<partvals;i++){
-    int offset=i*samples_per_partition+info->begin;
+  {
+    int *maxv=alloca(partvals*sizeof(*maxv));
+    int *entv=alloca(partvals*sizeof(*entv));
+
     for(j=0;j<ch;j++){
-      int max=0;
-      int ent=0;
-      for(k=0;k<samples_per_partition;k++){
-        if(abs(in[j][offset+k])>max)max=abs(in[j][offset+k]);
-        ent+=abs(in[j][offset+k]);
-      }
-      ent*=scale;
+      /* all partition statistics for the channel in one pass */
+      _partstats(in[j]+info->begin,partvals,samples_per_partition,maxv,entv);
 
-      for(k=0;k<possible_partitions-1;k++)
-        if(max<=info->classmetric1[k] &&
-           (info->classmetric2[k]<0 || ent<info->classmetric2[k]))
-          break;
+      for(i=0;i<partvals;i++){
+        int max=maxv[i];
+        int ent=entv[i];
+        ent*=scale;
+
+        for(k=0;k<possible_partitions-1;k++)
+          if(max<=info->classmetric1[k] &&
+             (info->classmetric2[k]<0 || ent<info->classmetric2[k]))
+            break;
 
-      partword[j][i]=k;
+        partword[j][i]=k;
+      }
     }
   }
 
@@ -470,7 +536,9 @@ static long **_01class(vorbis_block *vb,vorbis_look_residue *vl,
     }
   }
 #endif
+#if defined(TRAIN_RES) || defined (TRAIN_RESAUX)
   look->frames++;
+#endif
 
   return(partword);
 }
@@ -500,23 +568,30 @@ static long **_2class(vorbis_block *vb,vorbis_look_residue *vl,int **in,
   partword[0]=_vorbis_block_alloc(vb,partvals*sizeof(*partword[0]));
   memset(partword[0],0,partvals*sizeof(*partword[0]));
 
-  for(i=0,l=info->begin/ch;i<partvals;i++){
-    int magmax=0;
-    int angmax=0;
-    for(j=0;j<samples_per_partition;j+=ch){
-      if(abs(in[0][l])>magmax)magmax=abs(in[0][l]);
-      for(k=1;k<ch;k++)
-        if(abs(in[k][l])>angmax)angmax=abs(in[k][l]);
-      l++;
+  {
+    /* each partition covers the same run of every channel */
+    int size=(samples_per_partition+ch-1)/ch;
+    int *magmax=alloca(partvals*sizeof(*magmax));
+    int *angmax=alloca(partvals*sizeof(*angmax));
+    int *work=alloca(partvals*sizeof(*work));
+
+    l=info->begin/ch;
+    _partstats(in[0]+l,partvals,size,magmax,NULL);
+    memset(angmax,0,partvals*sizeof(*angmax));
+    for(k=1;k<ch;k++){
+      _partstats(in[k]+l,partvals,size,work,NULL);
+      for(i=0;i<partvals;i++)
+        if(work[i]>angmax[i])angmax[i]=work[i];
     }
 
-    for(j=0;j<possible_partitions-1;j++)
-      if(magmax<=info->classmetric1[j] &&
-         angmax<=info->classmetric2[j])
-        break;
-
-    partword[0][i]=j;
+    for(i=0;i<partvals;i++){
+      for(j=0;j<possible_partitions-1;j++)
+        if(magmax[i]<=info->classmetric1[j] &&
+           angmax[i]<=info->classmetric2[j])
+          break;
 
+      partword[0][i]=j;
+    }
   }
 
 #ifdef TRAIN_RESAUX
@@ -527,8 +602,9 @@ static long **_2class(vorbis_block *vb,vorbis_look_residue *vl,int **in,
   fprintf(of,"\n");
   fclose(of);
 #endif
-
+#if defined(TRAIN_RES) || defined (TRAIN_RESAUX)
   look->frames++;
+#endif
 
   return(partword);
 }
@@ -589,8 +665,12 @@ static int _01forward(oggpack_buffer *opb,
           }
 
           /* training hack */
-          if(val<look->phrasebook->entries)
-            look->phrasebits+=vorbis_book_encode(look->phrasebook,val,opb);
+          if(val<look->phrasebook->entries){
+#ifdef TRAIN_RES
+            look->phrasebits+=
+#endif
+              vorbis_book_encode(look->phrasebook,val,opb);
+          }
 #if 0 /*def TRAIN_RES*/
           else
             fprintf(stderr,"!");
@@ -628,7 +708,9 @@ static int _01forward(oggpack_buffer *opb,
               ret=encode(opb,in[j]+offset,samples_per_partition,
                          statebook,accumulator);
 
+#ifdef TRAIN_RES
               look->postbits+=ret;
+#endif
               resbits[partword[j][i]]+=ret;
             }
           }
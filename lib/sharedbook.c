@@ -277,6 +277,10 @@ void vorbis_book_clear(codebook *b){
   if(b->dec_codelengths)_ogg_free(b->dec_codelengths);
   if(b->dec_firsttable)_ogg_free(b->dec_firsttable);
 
+  if(b->enc_vals)_ogg_free(b->enc_vals);
+  if(b->enc_index)_ogg_free(b->enc_index);
+  if(b->enc_words)_ogg_free(b->enc_words);
+
   memset(b,0,sizeof(*b));
 }
 
@@ -287,12 +291,58 @@ int vorbis_book_init_encode(codebook *c,const static_codebook *s){
   c->entries=s->entries;
   c->used_entries=s->entries;
   c->dim=s->dim;
-  c->codelist=_make_words(s->lengthlist,s->entries,0);
+  c->enc_words=_ogg_calloc(s->entries,sizeof(*c->enc_words));
+  {
+    ogg_uint32_t *codes=_make_words(s->lengthlist,s->entries,0);
+    long i;
+    if(codes){
+      for(i=0;i<s->entries;i++){
+        c->enc_words[i].word=codes[i];
+        c->enc_words[i].length=s->lengthlist[i];
+      }
+      _ogg_free(codes);
+    }
+  }
   //c->valuelist=_book_unquantize(s,s->entries,NULL);
   c->quantvals=_book_maptype1_quantvals(s);
   c->minval=(int)rint(_float32_unpack(s->q_min));
   c->delta=(int)rint(_float32_unpack(s->q_delta));
 
+  /* When the residue search quantizes onto an unused entry of a
+     sparse book, it falls back to a nearest-entry search.  Collect
+     the populated entries up front so that search needn't walk the
+     whole lattice.  The values follow the same patterning (that of
+     the tools in vq/) the search has always assumed. */
+  if(s->maptype==1 && s->dim<=8){
+    long i,j,used=0;
+
+    for(i=0;i<s->entries;i++)
+      if(s->lengthlist[i]>0)used++;
+
+    if(used<s->entries){
+      int e[9]={0,0,0,0,0,0,0,0,0};
+      int maxval=c->minval+c->delta*(c->quantvals-1);
+
+      c->enc_vals=_ogg_malloc((used?used:1)*s->dim*sizeof(*c->enc_vals));
+      c->enc_index=_ogg_malloc((used?used:1)*sizeof(*c->enc_index));
+
+      for(i=0;i<s->entries;i++){
+        if(s->lengthlist[i]>0){
+          memcpy(c->enc_vals+c->enc_used*s->dim,e,s->dim*sizeof(*e));
+          c->enc_index[c->enc_used++]=i;
+        }
+        if(i+1<s->entries){
+          j=0;
+          while(e[j]>=maxval)
+            e[j++]=0;
+          if(e[j]>=0)
+            e[j]+=c->delta;
+          e[j]= -e[j];
+        }
+      }
+    }
+  }
+
   return(0);
 }
 
@@ -430,7 +480,7 @@ int vorbis_book_init_decode(codebook *c,const static_codebook *s){
 long vorbis_book_codeword(codebook *book,int entry){
   if(book->c) /* only use with encode; decode optimizations are
                  allowed to break this */
-    return book->codelist[entry];
+    return book->enc_words[entry].word;
   return -1;
 }
 
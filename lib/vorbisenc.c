@@ -615,6 +615,42 @@ static void vorbis_encode_map_n_res_setup(vorbis_info *vi,double s,
   }
 }
 
+/* OV_ECTL_SPEED_SET; each level adds to the shortcuts of the last */
+static void vorbis_encode_speed_setup(vorbis_info *vi,int speed){
+  codec_setup_info *ci=vi->codec_setup;
+  int i;
+
+  if(speed<1)return;
+
+  /* 1: seed tone masking from spectral peaks only, and drop the
+     fixed width noise window pass */
+  for(i=0;i<ci->psys;i++){
+    ci->psy_param[i]->tone_peaks=1;
+    ci->psy_param[i]->noisewindowfixed=0;
+  }
+  if(speed<2)return;
+
+  /* 2: half the tone masking resolution, no noise normalization,
+     and a looser floor fit that splits fewer segments */
+  ci->psy_g_param.eighth_octave_lines/=2;
+  for(i=0;i<ci->psys;i++)
+    ci->psy_param[i]->normal_p=0;
+  for(i=0;i<ci->floors;i++)
+    if(ci->floor_type[i]==1){
+      vorbis_info_floor1 *f=ci->floor_param[i];
+      f->maxover*=2.f;
+      f->maxunder*=2.f;
+      f->maxerr*=2.f;
+    }
+  if(speed<3)return;
+
+  /* 3: tonal estimate from the MDCT rather than a separate FFT, and a
+     single transient detector on the channel mix */
+  for(i=0;i<ci->psys;i++)
+    ci->psy_param[i]->tone_mdct=1;
+  ci->psy_g_param.envelope_mix=1;
+}
+
 static double setting_to_approx_bitrate(vorbis_info *vi){
   codec_setup_info *ci=vi->codec_setup;
   highlevel_encode_setup *hi=&ci->hi;
@@ -825,6 +861,8 @@ int vorbis_encode_setup_init(vorbis_info *vi){
     vorbis_encode_ath_setup(vi,3);
   }
 
+  vorbis_encode_speed_setup(vi,hi->speed);
+
   vorbis_encode_map_n_res_setup(vi,hi->base_setting,setup->maps);
 
   /* set bitrate readonlies and management */
@@ -987,6 +1025,32 @@ int vorbis_encode_setup_managed(vorbis_info *vi,
 
 }
 
+vorbis_encode_config *vorbis_encode_config_new(vorbis_info *vi){
+  return _vi_shared_freeze(vi);
+}
+
+vorbis_encode_config *vorbis_encode_config_vbr(long channels,
+                                               long rate,
+                                               float base_quality){
+  vorbis_encode_config *cfg=NULL;
+  vorbis_info vi;
+
+  vorbis_info_init(&vi);
+  if(!vorbis_encode_init_vbr(&vi,channels,rate,base_quality)){
+    cfg=vorbis_encode_config_new(&vi);
+    vorbis_info_clear(&vi);
+  }
+  return(cfg);
+}
+
+int vorbis_encode_init_config(vorbis_info *vi,vorbis_encode_config *cfg){
+  return _vi_shared_attach(vi,cfg);
+}
+
+void vorbis_encode_config_free(vorbis_encode_config *cfg){
+  if(cfg)_vi_shared_release(cfg);
+}
+
 int vorbis_encode_init(vorbis_info *vi,
                        long channels,
                        long rate,
@@ -1208,8 +1272,79 @@ int vorbis_encode_ctl(vorbis_info *vi,int number,void *arg){
         vorbis_encode_setup_setting(vi,vi->channels,vi->rate);
       }
       return(0);
+    case OV_ECTL_LATENCY_GET:
+      {
+        long *larg=(long *)arg;
+        long lookahead;
+        if(larg==NULL)return OV_EINVAL;
+        if(hi->set_in_stone){
+          *larg=_ve_latency(ci->blocksizes[0],ci->blocksizes[1],
+                            hi->latency_max,&lookahead);
+        }else{
+          /* same choice as vorbis_encode_blocksize_setup will make */
+          const ve_setup_data_template *setup=hi->setup;
+          int is=hi->base_setting;
+          if(setup==NULL)return(OV_EINVAL);
+          *larg=_ve_latency(setup->blocksize_short[is],
+                            setup->blocksize_long[is],
+                            hi->latency_max,&lookahead);
+        }
+      }
+      return(0);
+    case OV_ECTL_LATENCY_SET:
+      {
+        long *larg=(long *)arg;
+        hi->latency_max=(larg && *larg>0?*larg:0);
+      }
+      return(0);
+    case OV_ECTL_SPEED_GET:
+      {
+        int *iarg=(int *)arg;
+        if(iarg==NULL)return OV_EINVAL;
+        *iarg=hi->speed;
+      }
+      return(0);
+    case OV_ECTL_SPEED_SET:
+      {
+        int *iarg=(int *)arg;
+        if(iarg==NULL)
+          hi->speed=0;
+        else{
+          if(*iarg<0 || *iarg>OV_SPEED_MAX)return OV_EINVAL;
+          hi->speed=*iarg;
+        }
+      }
+      return(0);
+    case OV_ECTL_PACKETBLOBS_GET:
+      {
+        struct ovectl_packetblobs_arg *ai=
+          (struct ovectl_packetblobs_arg *)arg;
+        if(ai==NULL)return OV_EINVAL;
+
+        ai->lazy=hi->blobs_lazy;
+        ai->threads=hi->blobs_threads;
+      }
+      return(0);
+    case OV_ECTL_PACKETBLOBS_SET:
+      {
+        struct ovectl_packetblobs_arg *ai=
+          (struct ovectl_packetblobs_arg *)arg;
+        if(ai==NULL){
+          hi->blobs_lazy=0;
+          hi->blobs_threads=0;
+        }else{
+          if(ai->threads<0)return OV_EINVAL;
+          hi->blobs_lazy=(ai->lazy!=0);
+          hi->blobs_threads=ai->threads;
+        }
+      }
+      return(0);
     }
     return(OV_EIMPL);
   }
   return(OV_EINVAL);
 }
+
+void vorbis_encode_cache_flush(void){
+  _vp_psy_tables_flush();
+}
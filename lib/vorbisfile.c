@@ -29,6 +29,7 @@
 
 #include "os.h"
 #include "misc.h"
+#include "codec_internal.h"
 
 /* A 'chained bitstream' is a Vorbis bitstream that contains more than
    one logical bitstream arranged end to end (the only form of Ogg
@@ -63,6 +64,7 @@
 */
 #define CHUNKSIZE 65536 /* greater-than-page-size granularity seeking */
 #define READSIZE 2048 /* a smaller read size is needed for low-rate streaming. */
+#define SEEKSLACK 4096 /* initial page size estimate for bisection */
 
 static long _get_data(OggVorbis_File *vf){
   errno=0;
@@ -1079,6 +1081,464 @@ int ov_test_open(OggVorbis_File *vf){
   return _ov_open2(vf);
 }
 
+static void _copy_comment(vorbis_comment *vc,vorbis_comment *src){
+  int i;
+
+  vorbis_comment_init(vc);
+  vc->comments=src->comments;
+  vc->user_comments=_ogg_calloc(src->comments+1,sizeof(*vc->user_comments));
+  vc->comment_lengths=_ogg_calloc(src->comments+1,sizeof(*vc->comment_lengths));
+  for(i=0;i<src->comments;i++){
+    vc->comment_lengths[i]=src->comment_lengths[i];
+    vc->user_comments[i]=_ogg_malloc(src->comment_lengths[i]+1);
+    memcpy(vc->user_comments[i],src->user_comments[i],src->comment_lengths[i]+1);
+  }
+  if(src->vendor){
+    size_t len=strlen(src->vendor)+1;
+    vc->vendor=_ogg_malloc(len);
+    memcpy(vc->vendor,src->vendor,len);
+  }
+}
+
+/* opens a second view of an opened seekable file on a new datasource
+   for the same bytes.  The link layout found by the original open is
+   copied rather than rediscovered, and the codec setup and decode
+   codebooks of each link are shared (refcounted, read only) rather
+   than read and built again.  The first clone of a link reads its
+   setup once more through its own datasource and lends it to vf, so
+   vf is never modified and may be decoding meanwhile.  The views may
+   be used and cleared independently from different threads. */
+int ov_clone(OggVorbis_File *vf,void *datasource,OggVorbis_File *clone,
+             ov_callbacks callbacks){
+  int i,ret;
+
+  /* vf may be being read from another thread; look only at what its
+     open left behind, not at ready_state */
+  if(!vf->seekable)return(vf->links?OV_ENOSEEK:OV_EINVAL);
+  if(vf->end<=0)return(OV_EINVAL); /* not through ov_test_open() yet */
+  if(!callbacks.seek_func || !callbacks.tell_func)return(OV_EINVAL);
+
+  memset(clone,0,sizeof(*clone));
+  clone->datasource=datasource;
+  clone->callbacks=callbacks;
+  clone->seekable=1;
+  clone->links=vf->links;
+  clone->end=vf->end;
+  ogg_sync_init(&clone->oy);
+  ogg_stream_init(&clone->os,-1);
+
+  clone->offsets=_ogg_malloc((vf->links+1)*sizeof(*clone->offsets));
+  clone->dataoffsets=_ogg_malloc(vf->links*sizeof(*clone->dataoffsets));
+  clone->serialnos=_ogg_malloc(vf->links*sizeof(*clone->serialnos));
+  clone->pcmlengths=_ogg_malloc(vf->links*2*sizeof(*clone->pcmlengths));
+  clone->vi=_ogg_calloc(vf->links,sizeof(*clone->vi));
+  clone->vc=_ogg_calloc(vf->links,sizeof(*clone->vc));
+  memcpy(clone->offsets,vf->offsets,(vf->links+1)*sizeof(*clone->offsets));
+  memcpy(clone->dataoffsets,vf->dataoffsets,
+         vf->links*sizeof(*clone->dataoffsets));
+  memcpy(clone->serialnos,vf->serialnos,vf->links*sizeof(*clone->serialnos));
+  memcpy(clone->pcmlengths,vf->pcmlengths,
+         vf->links*2*sizeof(*clone->pcmlengths));
+
+  for(i=0;i<vf->links;i++){
+    vorbis_info_init(clone->vi+i);
+    if(vorbis_info_copy(clone->vi+i,vf->vi+i)){
+      vorbis_comment vc;
+
+      vorbis_info_clear(clone->vi+i);
+      ret=_seek_helper(clone,clone->offsets[i]);
+      if(ret)goto clone_error;
+      ret=_fetch_headers(clone,clone->vi+i,&vc,NULL,NULL,NULL);
+      if(ret)goto clone_error;
+      vorbis_comment_clear(&vc);
+      ret=vorbis_info_copy(clone->vi+i,vf->vi+i);
+      if(ret)goto clone_error;
+    }
+    _copy_comment(clone->vc+i,vf->vc+i);
+  }
+
+  clone->ready_state=OPENED;
+  clone->current_serialno=clone->serialnos[0];
+  ret=ov_raw_seek(clone,clone->dataoffsets[0]);
+  if(ret)goto clone_error;
+  return 0;
+
+ clone_error:
+  clone->datasource=NULL;
+  ov_clear(clone);
+  return ret;
+}
+
+/* comment header rewriting ****************************************/
+
+/* where rewritten pages go; with no write_func they're only counted */
+typedef struct {
+  size_t (*write_func)(const void *ptr,size_t size,size_t nmemb,void *out);
+  void *out;
+  ogg_int64_t bytes;
+  int pages;
+} page_sink;
+
+static int _sink_page(page_sink *s,ogg_page *og){
+  if(s->write_func &&
+     ((s->write_func)(og->header,1,og->header_len,s->out)!=
+      (size_t)og->header_len ||
+      (s->write_func)(og->body,1,og->body_len,s->out)!=
+      (size_t)og->body_len))
+    return(OV_EREAD);
+  s->bytes+=og->header_len+og->body_len;
+  s->pages++;
+  return 0;
+}
+
+/* the new comment header and the original setup header, paged as the
+   originals were: the setup header starts a fresh page if the
+   comment header ended one, and ends its own page */
+static int _sink_headers(page_sink *s,ogg_stream_state *os,
+                         ogg_packet *comment,int comment_page,
+                         ogg_packet *setup){
+  ogg_page og;
+  ogg_stream_packetin(os,comment);
+  if(comment_page)
+    while(ogg_stream_flush(os,&og))
+      if(_sink_page(s,&og))return(OV_EREAD);
+  ogg_stream_packetin(os,setup);
+  while(ogg_stream_flush(os,&og))
+    if(_sink_page(s,&og))return(OV_EREAD);
+  return 0;
+}
+
+static int _vorbis_bos_page(ogg_page *og){
+  return ogg_page_bos(og) && og->body_len>=7 && og->body[0]==0x01 &&
+    !memcmp(og->body+1,"vorbis",6);
+}
+
+static void _copy_packet(ogg_packet *dst,ogg_packet *src){
+  *dst=*src;
+  dst->packet=_ogg_malloc(src->bytes);
+  memcpy(dst->packet,src->packet,src->bytes);
+}
+
+/* feed one page of the stream being retagged; keeps copies of the
+   comment and setup headers and notes whether the comment header
+   ended its page.  Returns the number of header packets read so far */
+static int _rewrite_headerin(ogg_stream_state *os,ogg_page *og,
+                             int *packets,int *comment_page,
+                             ogg_packet *headers){
+  ogg_packet op;
+  int ret;
+
+  if(ogg_stream_pagein(os,og))return(OV_EBADHEADER);
+  while(*packets<3 && (ret=ogg_stream_packetout(os,&op))){
+    if(ret<0 || op.bytes<7 || op.packet[0]!=*packets*2+1 ||
+       memcmp(op.packet+1,"vorbis",6))
+      return(OV_EBADHEADER);
+    if(*packets)_copy_packet(headers+*packets-1,&op);
+    (*packets)++;
+
+    /* the identification header has a page to itself, and the first
+       audio packet starts a fresh page; a comment header may span
+       any number of pages */
+    if((*packets==1 || *packets==3) && os->lacing_returned<os->lacing_fill)
+      return(OV_EBADHEADER);
+    if(*packets==2)*comment_page=(os->lacing_returned==os->lacing_fill);
+  }
+  return *packets;
+}
+
+/* vc packed as a comment header under the vendor string of the
+   original comment header, as vcedit does */
+static int _comment_packet(vorbis_comment *vc,ogg_packet *orig,
+                           long padding,ogg_packet *op){
+  oggpack_buffer opb;
+  long vendor;
+  int i;
+
+  oggpack_readinit(&opb,orig->packet,orig->bytes);
+  oggpack_adv(&opb,7*8);
+  vendor=oggpack_read(&opb,32);
+  if(vendor<0 || vendor>orig->bytes-11)return(OV_EBADHEADER);
+
+  oggpack_writeinit(&opb);
+  for(i=0;i<11+vendor;i++)
+    oggpack_write(&opb,orig->packet[i],8);
+  oggpack_write(&opb,vc->comments,32);
+  for(i=0;i<vc->comments;i++){
+    long j,bytes=(vc->user_comments[i]?vc->comment_lengths[i]:0);
+    oggpack_write(&opb,bytes,32);
+    for(j=0;j<bytes;j++)
+      oggpack_write(&opb,vc->user_comments[i][j],8);
+  }
+  oggpack_write(&opb,1,1);
+
+  memset(op,0,sizeof(*op));
+  op->bytes=oggpack_bytes(&opb)+padding;
+  op->packetno=1;
+  /* zeroes after the framing bit are ignored by decoders */
+  op->packet=_ogg_calloc(op->bytes,1);
+  memcpy(op->packet,oggpack_get_buffer(&opb),oggpack_bytes(&opb));
+  oggpack_writeclear(&opb);
+  return 0;
+}
+
+static void _page_renumber(ogg_page *og,long pageno){
+  int i;
+  for(i=18;i<22;i++){
+    og->header[i]=pageno&0xff;
+    pageno>>=8;
+  }
+  ogg_page_checksum_set(og);
+}
+
+/* writes a copy of the stream read through datasource/callbacks with
+   the comments of its first Vorbis link replaced by vc's (the vendor
+   string is kept), padded with padding zero bytes.  The identification and setup headers and
+   all other pages are kept byte for byte; only the first link's
+   header pages are rebuilt, and its later pages renumbered if the
+   header page count changed.  Everything past that is copied in
+   large blocks without being parsed. */
+int ov_comment_rewrite(void *datasource,ov_callbacks callbacks,
+                       vorbis_comment *vc,long padding,
+                       size_t (*write_func)(const void *ptr,size_t size,
+                                            size_t nmemb,void *out),
+                       void *out){
+  OggVorbis_File vf; /* only its reading state is used */
+  ogg_stream_state os,rs;
+  ogg_packet comment,headers[2];
+  ogg_page og;
+  page_sink s;
+  int serialno=0,found=0,first;
+  int packets=0,comment_page=0,pages=0,delta=0;
+  int ret;
+
+  if(!callbacks.read_func || !write_func || padding<0)return(OV_EINVAL);
+  memset(&vf,0,sizeof(vf));
+  memset(&s,0,sizeof(s));
+  memset(&comment,0,sizeof(comment));
+  memset(headers,0,sizeof(headers));
+  vf.datasource=datasource;
+  vf.callbacks=callbacks;
+  ogg_sync_init(&vf.oy);
+  s.write_func=write_func;
+  s.out=out;
+  if(callbacks.seek_func)
+    (callbacks.seek_func)(datasource,0,SEEK_SET); /* a pipe can't */
+
+  /* the header pages; other streams' pages pass through */
+  while(packets<3){
+    ogg_int64_t llret=_get_next_page(&vf,&og,-1);
+    if(llret<0){
+      ret=(llret==OV_EREAD?OV_EREAD:found?OV_EBADHEADER:OV_ENOTVORBIS);
+      goto rewrite_out;
+    }
+    if(!found){
+      if(!ogg_page_bos(&og)){
+        ret=OV_ENOTVORBIS;
+        goto rewrite_out;
+      }
+      if(_vorbis_bos_page(&og)){
+        found=1;
+        serialno=ogg_page_serialno(&og);
+        ogg_stream_init(&os,serialno);
+        ogg_stream_init(&rs,serialno);
+      }
+    }
+    if(!found || ogg_page_serialno(&og)!=serialno){
+      if((ret=_sink_page(&s,&og)))goto rewrite_out;
+      continue;
+    }
+
+    first=!packets;
+    ret=_rewrite_headerin(&os,&og,&packets,&comment_page,headers);
+    if(ret>=0 && first && packets!=1)ret=OV_EBADHEADER;
+    if(ret<0)goto rewrite_out;
+    if(first){
+      /* the identification header page is kept as it is */
+      if((ret=_sink_page(&s,&og)))goto rewrite_out;
+      rs.b_o_s=1;
+      rs.pageno=ogg_page_pageno(&og)+1;
+    }else{
+      pages++;
+      if(packets==3){
+        int before=s.pages;
+        if((ret=_comment_packet(vc,headers,padding,&comment)))
+          goto rewrite_out;
+        if((ret=_sink_headers(&s,&rs,&comment,comment_page,headers+1)))
+          goto rewrite_out;
+        delta=s.pages-before-pages;
+        pages=0;
+      }
+    }
+  }
+
+  /* renumber the rest of the link's pages if need be */
+  while(delta){
+    int result=ogg_sync_pageout(&vf.oy,&og);
+    if(result<0)continue; /* skipped garbage */
+    if(result==0){
+      char *buffer=ogg_sync_buffer(&vf.oy,CHUNKSIZE);
+      long bytes;
+      errno=0;
+      bytes=(callbacks.read_func)(buffer,1,CHUNKSIZE,datasource);
+      if(bytes==0 && errno){
+        ret=OV_EREAD;
+        goto rewrite_out;
+      }
+      if(bytes<=0)break;
+      ogg_sync_wrote(&vf.oy,bytes);
+      continue;
+    }
+    if(ogg_page_serialno(&og)==serialno){
+      _page_renumber(&og,ogg_page_pageno(&og)+delta);
+      if(ogg_page_eos(&og))delta=0;
+    }
+    if((ret=_sink_page(&s,&og)))goto rewrite_out;
+  }
+
+  /* and copy the remainder as it is */
+  {
+    long bytes=vf.oy.fill-vf.oy.returned;
+    if(bytes>0 &&
+       (write_func)(vf.oy.data+vf.oy.returned,1,bytes,out)!=(size_t)bytes){
+      ret=OV_EREAD;
+      goto rewrite_out;
+    }
+    vf.oy.returned=vf.oy.fill;
+    for(;;){
+      char *buffer=ogg_sync_buffer(&vf.oy,CHUNKSIZE);
+      errno=0;
+      bytes=(callbacks.read_func)(buffer,1,CHUNKSIZE,datasource);
+      if(bytes==0 && errno){
+        ret=OV_EREAD;
+        goto rewrite_out;
+      }
+      if(bytes<=0)break;
+      if((write_func)(buffer,1,bytes,out)!=(size_t)bytes){
+        ret=OV_EREAD;
+        goto rewrite_out;
+      }
+    }
+  }
+  ret=0;
+
+ rewrite_out:
+  if(found){
+    ogg_stream_clear(&os);
+    ogg_stream_clear(&rs);
+  }
+  ogg_sync_clear(&vf.oy);
+  if(comment.packet)_ogg_free(comment.packet);
+  if(headers[0].packet)_ogg_free(headers[0].packet);
+  if(headers[1].packet)_ogg_free(headers[1].packet);
+  return ret;
+}
+
+/* replaces the comment header of the first Vorbis link in place when
+   the new one, padded with zeroes, can be paged into exactly the bytes
+   and pages the old comment and setup headers took.  The datasource
+   must be seekable and writable through write_func.  Returns OV_FALSE,
+   having written nothing, if the new comments don't fit. */
+int ov_comment_rewrite_inplace(void *datasource,ov_callbacks callbacks,
+                               vorbis_comment *vc,
+                               size_t (*write_func)(const void *ptr,
+                                                    size_t size,
+                                                    size_t nmemb,
+                                                    void *datasource)){
+  OggVorbis_File vf;
+  ogg_stream_state os,rs;
+  ogg_packet comment,headers[2];
+  ogg_page og;
+  page_sink s;
+  ogg_int64_t begin=0,end=0;
+  long padding=0,pageno=0;
+  int found=0,first,packets=0,comment_page=0,pages=0,tries;
+  int ret;
+
+  if(!callbacks.read_func || !write_func)return(OV_EINVAL);
+  if(!callbacks.seek_func ||
+     (callbacks.seek_func)(datasource,0,SEEK_SET)==-1)return(OV_ENOSEEK);
+  memset(&vf,0,sizeof(vf));
+  memset(&comment,0,sizeof(comment));
+  memset(headers,0,sizeof(headers));
+  vf.datasource=datasource;
+  vf.callbacks=callbacks;
+  ogg_sync_init(&vf.oy);
+
+  /* the header pages must lie end to end from the start of the file */
+  while(packets<3){
+    ogg_int64_t llret=_get_next_page(&vf,&og,-1);
+    if(llret<0){
+      ret=(llret==OV_EREAD?OV_EREAD:packets?OV_EBADHEADER:OV_ENOTVORBIS);
+      goto inplace_out;
+    }
+    if(!packets){
+      if(!_vorbis_bos_page(&og)){
+        ret=(ogg_page_bos(&og)?OV_FALSE:OV_ENOTVORBIS);
+        goto inplace_out;
+      }
+      found=1;
+      ogg_stream_init(&os,ogg_page_serialno(&og));
+      ogg_stream_init(&rs,ogg_page_serialno(&og));
+      pageno=ogg_page_pageno(&og)+1;
+    }else if(ogg_page_serialno(&og)!=os.serialno || llret!=end){
+      ret=OV_FALSE;
+      goto inplace_out;
+    }
+    end=llret+og.header_len+og.body_len;
+
+    first=!packets;
+    ret=_rewrite_headerin(&os,&og,&packets,&comment_page,headers);
+    if(ret>=0 && first && packets!=1)ret=OV_EBADHEADER;
+    if(ret<0)goto inplace_out;
+    if(first)
+      begin=end;
+    else
+      pages++;
+  }
+
+  /* find the padding that makes the new headers page to the old size;
+     each padding byte adds at least a byte */
+  for(tries=0;tries<16 && padding>=0;tries++){
+    if(comment.packet)_ogg_free(comment.packet);
+    if((ret=_comment_packet(vc,headers,padding,&comment)))
+      goto inplace_out;
+    memset(&s,0,sizeof(s));
+    ogg_stream_reset(&rs);
+    rs.b_o_s=1;
+    rs.pageno=pageno;
+    _sink_headers(&s,&rs,&comment,comment_page,headers+1);
+    if(s.bytes==end-begin)break;
+    padding+=end-begin-s.bytes;
+  }
+  if(padding<0 || tries==16 || s.pages!=pages){
+    ret=OV_FALSE;
+    goto inplace_out;
+  }
+
+  if((callbacks.seek_func)(datasource,begin,SEEK_SET)==-1){
+    ret=OV_ENOSEEK;
+    goto inplace_out;
+  }
+  memset(&s,0,sizeof(s));
+  s.write_func=write_func;
+  s.out=datasource;
+  ogg_stream_reset(&rs);
+  rs.b_o_s=1;
+  rs.pageno=pageno;
+  ret=_sink_headers(&s,&rs,&comment,comment_page,headers+1);
+
+ inplace_out:
+  if(found){
+    ogg_stream_clear(&os);
+    ogg_stream_clear(&rs);
+  }
+  ogg_sync_clear(&vf.oy);
+  if(comment.packet)_ogg_free(comment.packet);
+  if(headers[0].packet)_ogg_free(headers[0].packet);
+  if(headers[1].packet)_ogg_free(headers[1].packet);
+  return ret;
+}
+
 /* How many logical bitstreams in this physical bitstream? */
 long ov_streams(OggVorbis_File *vf){
   return vf->links;
@@ -1423,7 +1883,9 @@ int ov_pcm_seek_page(OggVorbis_File *vf,ogg_int64_t pos){
      bitstream could make our task impossible.  Account for that (it
      would be an error condition) */
 
-  /* new search algorithm by HB (Nicholas Vinen) */
+  /* new search algorithm by HB (Nicholas Vinen); interpolates within
+     the bracket of the closest pages seen so far and lands about a
+     page ahead of the estimate */
   {
     ogg_int64_t end=vf->offsets[link+1];
     ogg_int64_t begin=vf->offsets[link];
@@ -1431,19 +1893,20 @@ int ov_pcm_seek_page(OggVorbis_File *vf,ogg_int64_t pos){
     ogg_int64_t endtime = vf->pcmlengths[link*2+1]+begintime;
     ogg_int64_t target=pos-total+begintime;
     ogg_int64_t best=begin;
+    ogg_int64_t pagebytes=SEEKSLACK; /* largest page seen so far */
 
     ogg_page og;
     while(begin<end){
       ogg_int64_t bisect;
 
-      if(end-begin<CHUNKSIZE){
+      if(end-begin<pagebytes*2){
         bisect=begin;
       }else{
         /* take a (pretty decent) guess. */
         bisect=begin +
           (ogg_int64_t)((double)(target-begintime)*(end-begin)/(endtime-begintime))
-          - CHUNKSIZE;
-        if(bisect<begin+CHUNKSIZE)
+          - pagebytes;
+        if(bisect<begin+pagebytes)
           bisect=begin;
       }
 
@@ -1468,6 +1931,9 @@ int ov_pcm_seek_page(OggVorbis_File *vf,ogg_int64_t pos){
         }else{
           ogg_int64_t granulepos;
 
+          if(vf->offset-result>pagebytes)
+            pagebytes=vf->offset-result;
+
           if(ogg_page_serialno(&og)!=vf->serialnos[link])
             continue;
 
@@ -1479,7 +1945,10 @@ int ov_pcm_seek_page(OggVorbis_File *vf,ogg_int64_t pos){
             begin=vf->offset; /* raw offset of next page */
             begintime=granulepos;
 
-            if(target-begintime>44100)break;
+            /* still more than a couple of pages short; guess again
+               rather than read our way there */
+            if((double)(target-begintime)*(end-begin)/(endtime-begintime)
+               > pagebytes*2)break;
             bisect=begin; /* *not* begin + 1 */
           }else{
             if(bisect<=begin+1)
@@ -1594,7 +2063,10 @@ int ov_pcm_seek(OggVorbis_File *vf,ogg_int64_t pos){
   if((ret=_make_decode_ready(vf)))return ret;
 
   /* discard leading packets we don't need for the lapping of the
-     position we want; don't decode them */
+     position we want; don't decode them.  The first block decoded
+     only primes the overlap, so the last block centered at or before
+     pos is the one to start decoding from.  A long block's header
+     tells us the size of the block after it; otherwise assume long */
 
   while(1){
     ogg_packet op;
@@ -1602,21 +2074,24 @@ int ov_pcm_seek(OggVorbis_File *vf,ogg_int64_t pos){
 
     int ret=ogg_stream_packetpeek(&vf->os,&op);
     if(ret>0){
-      thisblock=vorbis_packet_blocksize(vf->vi+vf->current_link,&op);
+      vorbis_info *vi=vf->vi+vf->current_link;
+      int nextblock=vorbis_info_blocksize(vi,1);
+
+      thisblock=vorbis_packet_blocksize(vi,&op);
       if(thisblock<0){
         ogg_stream_packetout(&vf->os,NULL);
         continue; /* non audio packet */
       }
       if(lastblock)vf->pcm_offset+=(lastblock+thisblock)>>2;
 
-      if(vf->pcm_offset+((thisblock+
-                          vorbis_info_blocksize(vf->vi,1))>>2)>=pos)break;
+      /* set up a vb with only tracking, no pcm_decode */
+      if(!vorbis_synthesis_trackonly(&vf->vb,&op) && vf->vb.W)
+        nextblock=vorbis_info_blocksize(vi,vf->vb.nW);
+
+      if(vf->pcm_offset+((thisblock+nextblock)>>2)>pos)break;
 
       /* remove the packet from packet queue and track its granulepos */
       ogg_stream_packetout(&vf->os,NULL);
-      vorbis_synthesis_trackonly(&vf->vb,&op);  /* set up a vb with
-                                                   only tracking, no
-                                                   pcm_decode */
       vorbis_synthesis_blockin(&vf->vd,&vf->vb);
 
       /* end of logical stream case is hard, especially with exact
@@ -0,0 +1,743 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2012             *
+ * by the Xiph.Org Foundation http://www.xiph.org/                  *
+ *                                                                  *
+ ********************************************************************
+
+ function: encoder tests for vorbis codec test suite.
+ last mod: $Id$
+
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vorbis/codec.h>
+#include <vorbis/vorbisenc.h>
+
+#include "encode.h"
+
+#define CHANNELS        2
+#define RATE            44100
+
+/* Samples handed to the encoder per call. */
+#define CHUNK           1000
+
+/* Every packet an encoder produced, headers included, back to back. */
+typedef struct {
+  unsigned char *data ;
+  long           bytes ;
+  long           storage ;
+} packet_log ;
+
+typedef struct test_encoder {
+  vorbis_info      vi ;
+  vorbis_comment   vc ;
+  vorbis_dsp_state vd ;
+  vorbis_block     vb ;
+  packet_log       log ;
+
+  /* takes each block of this encoder through
+     vorbis_analysis_blockout_follow() */
+  struct test_encoder *follower ;
+} test_encoder ;
+
+static void
+log_append (packet_log *log, const void *ptr, long bytes)
+{
+  if (log->bytes + bytes > log->storage) {
+    log->storage = (log->bytes + bytes) * 2 ;
+    log->data = realloc (log->data, log->storage) ;
+    if (log->data == NULL) {
+      printf ("\n\nError : out of memory.\n") ;
+      exit (1) ;
+    }
+  }
+  memcpy (log->data + log->bytes, ptr, bytes) ;
+  log->bytes += bytes ;
+}
+
+static void
+log_packet (packet_log *log, const ogg_packet *op)
+{
+  log_append (log, &op->bytes, sizeof (op->bytes)) ;
+  log_append (log, &op->granulepos, sizeof (op->granulepos)) ;
+  log_append (log, &op->e_o_s, sizeof (op->e_o_s)) ;
+  log_append (log, op->packet, op->bytes) ;
+}
+
+/* Starts an encoder whose vi has been set up, logging its headers. */
+static void
+encoder_start (test_encoder *e)
+{
+  ogg_packet header ;
+  ogg_packet header_comm ;
+  ogg_packet header_code ;
+
+  memset (&e->log, 0, sizeof (e->log)) ;
+  e->follower = NULL ;
+  vorbis_comment_init (&e->vc) ;
+  vorbis_comment_add_tag (&e->vc, "ENCODER", "test/encode.c") ;
+  vorbis_analysis_init (&e->vd, &e->vi) ;
+  vorbis_block_init (&e->vd, &e->vb) ;
+
+  vorbis_analysis_headerout (&e->vd, &e->vc, &header, &header_comm, &header_code) ;
+  log_packet (&e->log, &header) ;
+  log_packet (&e->log, &header_comm) ;
+  log_packet (&e->log, &header_code) ;
+}
+
+static void
+encoder_flush (test_encoder *e, vorbis_block *vb)
+{
+  ogg_packet op ;
+
+  vorbis_bitrate_addblock (vb) ;
+  while (vorbis_bitrate_flushpacket (&e->vd, &op))
+    log_packet (&e->log, &op) ;
+}
+
+/* Analyzes and logs every block the encoder has ready, and the
+ * follower's block for each. */
+static void
+encoder_drain (test_encoder *e)
+{
+  while (vorbis_analysis_blockout (&e->vd, &e->vb) == 1) {
+    vorbis_analysis (&e->vb, NULL) ;
+    if (e->follower) {
+      test_encoder *f = e->follower ;
+      int ret = vorbis_analysis_blockout_follow (&f->vd, &f->vb, &e->vb) ;
+      if (ret != 1) {
+        printf ("\n\nError : vorbis_analysis_blockout_follow returned %d.\n", ret) ;
+        exit (1) ;
+      }
+      vorbis_analysis (&f->vb, NULL) ;
+      encoder_flush (f, &f->vb) ;
+    }
+    encoder_flush (e, &e->vb) ;
+  }
+}
+
+/* Clears all but the packet log. */
+static void
+encoder_finish (test_encoder *e)
+{
+  vorbis_block_clear (&e->vb) ;
+  vorbis_dsp_clear (&e->vd) ;
+  vorbis_comment_clear (&e->vc) ;
+  vorbis_info_clear (&e->vi) ;
+}
+
+/* Where sample i of channel j comes from in the supplied data; each
+ * channel is rotated so that the channels differ. */
+static int
+source_index (int count, int j, int i)
+{
+  return (i + j * count / 3) % count ;
+}
+
+static void
+encode_planar (test_encoder *e, const float * data, int count)
+{
+  int i, j, n ;
+
+  for (i = 0 ; i < count ; i += n) {
+    float **buffer ;
+
+    n = count - i < CHUNK ? count - i : CHUNK ;
+    buffer = vorbis_analysis_buffer (&e->vd, n) ;
+    for (j = 0 ; j < e->vi.channels ; j++) {
+      int k ;
+      for (k = 0 ; k < n ; k++)
+        buffer [j][k] = data [source_index (count, j, i + k)] ;
+    }
+    vorbis_analysis_wrote (&e->vd, n) ;
+    encoder_drain (e) ;
+  }
+  vorbis_analysis_wrote (&e->vd, 0) ;
+  encoder_drain (e) ;
+}
+
+enum { WRITE_F32, WRITE_S16, WRITE_S24 } ;
+
+/* As encode_planar(), with pcm already interleaved. */
+static void
+encode_interleaved (test_encoder *e, const void * pcm, int count, int format)
+{
+  int i, n, ret = 0 ;
+
+  for (i = 0 ; i < count && ret == 0 ; i += n) {
+    long offset = (long) i * e->vi.channels ;
+
+    n = count - i < CHUNK ? count - i : CHUNK ;
+    switch (format) {
+    case WRITE_F32:
+      ret = vorbis_analysis_write_interleaved_f32 (&e->vd,
+                (const float *) pcm + offset, n) ;
+      break ;
+    case WRITE_S16:
+      ret = vorbis_analysis_write_interleaved_s16 (&e->vd,
+                (const ogg_int16_t *) pcm + offset, n) ;
+      break ;
+    case WRITE_S24:
+      ret = vorbis_analysis_write_interleaved_s24 (&e->vd,
+                (const unsigned char *) pcm + offset * 3, n) ;
+      break ;
+    }
+    encoder_drain (e) ;
+  }
+  if (ret) {
+    printf ("\n\nError : interleaved write returned %d.\n", ret) ;
+    exit (1) ;
+  }
+  vorbis_analysis_wrote (&e->vd, 0) ;
+  encoder_drain (e) ;
+}
+
+static void
+vbr_encoder_start (test_encoder *e, float q)
+{
+  int ret ;
+
+  vorbis_info_init (&e->vi) ;
+  ret = vorbis_encode_init_vbr (&e->vi, CHANNELS, RATE, q) ;
+  if (ret) {
+    printf ("\n\nError : vorbis_encode_init_vbr returned %d.\n", ret) ;
+    exit (1) ;
+  }
+  encoder_start (e) ;
+}
+
+static void
+check_same_or_die (const char *what, const packet_log *a, const packet_log *b)
+{
+  if (a->bytes != b->bytes || memcmp (a->data, b->data, a->bytes)) {
+    printf ("\n\nError : %s does not encode the same stream.\n", what) ;
+    exit (1) ;
+  }
+}
+
+static void
+packetblobs_encode (test_encoder *e, const float * data, int count,
+                    struct ovectl_packetblobs_arg *arg)
+{
+  int ret ;
+
+  vorbis_info_init (&e->vi) ;
+  ret = vorbis_encode_setup_managed (&e->vi, CHANNELS, RATE, -1, 128000, -1) ;
+  if (ret == 0)
+    ret = vorbis_encode_ctl (&e->vi, OV_ECTL_PACKETBLOBS_SET, arg) ;
+  if (ret == 0)
+    ret = vorbis_encode_setup_init (&e->vi) ;
+  if (ret) {
+    printf ("\n\nError : managed setup returned %d.\n", ret) ;
+    exit (1) ;
+  }
+
+  encoder_start (e) ;
+  encode_planar (e, data, count) ;
+  encoder_finish (e) ;
+}
+
+void
+packetblobs_or_die (const float * data, int count)
+{
+  struct ovectl_packetblobs_arg lazy = { 1, 0 } ;
+  struct ovectl_packetblobs_arg threads = { 0, 4 } ;
+  test_encoder serial, other ;
+
+  packetblobs_encode (&serial, data, count, NULL) ;
+
+  packetblobs_encode (&other, data, count, &lazy) ;
+  check_same_or_die ("lazy packetblob generation", &serial.log, &other.log) ;
+  free (other.log.data) ;
+
+  packetblobs_encode (&other, data, count, &threads) ;
+  check_same_or_die ("threaded packetblob generation", &serial.log, &other.log) ;
+  free (other.log.data) ;
+
+  free (serial.log.data) ;
+}
+
+void
+interleaved_writers_or_die (const float * data, int count)
+{
+  float *ref = malloc (count * sizeof (*ref)) ;
+  float *f32 = malloc (count * CHANNELS * sizeof (*f32)) ;
+  ogg_int16_t *s16 = malloc (count * CHANNELS * sizeof (*s16)) ;
+  unsigned char *s24 = malloc (count * CHANNELS * 3) ;
+  test_encoder planar, other ;
+  int i, j ;
+
+  if (!ref || !f32 || !s16 || !s24) {
+    printf ("\n\nError : out of memory.\n") ;
+    exit (1) ;
+  }
+
+  for (i = 0 ; i < count ; i++)
+    for (j = 0 ; j < CHANNELS ; j++)
+      f32 [i * CHANNELS + j] = data [source_index (count, j, i)] ;
+
+  vbr_encoder_start (&planar, .3) ;
+  encode_planar (&planar, data, count) ;
+  encoder_finish (&planar) ;
+  vbr_encoder_start (&other, .3) ;
+  encode_interleaved (&other, f32, count, WRITE_F32) ;
+  encoder_finish (&other) ;
+  check_same_or_die ("vorbis_analysis_write_interleaved_f32", &planar.log, &other.log) ;
+  free (planar.log.data) ;
+  free (other.log.data) ;
+
+  /* integer input must encode as its exact float equivalent does */
+  for (i = 0 ; i < count ; i++)
+    ref [i] = (int) floor (data [i] * 32767.f + .5f) / 32768.f ;
+  for (i = 0 ; i < count ; i++)
+    for (j = 0 ; j < CHANNELS ; j++)
+      s16 [i * CHANNELS + j] = floor (data [source_index (count, j, i)] * 32767.f + .5f) ;
+
+  vbr_encoder_start (&planar, .3) ;
+  encode_planar (&planar, ref, count) ;
+  encoder_finish (&planar) ;
+  vbr_encoder_start (&other, .3) ;
+  encode_interleaved (&other, s16, count, WRITE_S16) ;
+  encoder_finish (&other) ;
+  check_same_or_die ("vorbis_analysis_write_interleaved_s16", &planar.log, &other.log) ;
+  free (planar.log.data) ;
+  free (other.log.data) ;
+
+  for (i = 0 ; i < count ; i++)
+    ref [i] = (int) floor (data [i] * 8388607.f + .5f) / 8388608.f ;
+  for (i = 0 ; i < count ; i++)
+    for (j = 0 ; j < CHANNELS ; j++) {
+      long v = floor (data [source_index (count, j, i)] * 8388607.f + .5f) ;
+      unsigned char *p = s24 + (i * CHANNELS + j) * 3 ;
+      p [0] = v & 0xff ;
+      p [1] = (v >> 8) & 0xff ;
+      p [2] = (v >> 16) & 0xff ;
+    }
+
+  vbr_encoder_start (&planar, .3) ;
+  encode_planar (&planar, ref, count) ;
+  encoder_finish (&planar) ;
+  vbr_encoder_start (&other, .3) ;
+  encode_interleaved (&other, s24, count, WRITE_S24) ;
+  encoder_finish (&other) ;
+  check_same_or_die ("vorbis_analysis_write_interleaved_s24", &planar.log, &other.log) ;
+  free (planar.log.data) ;
+  free (other.log.data) ;
+
+  free (ref) ;
+  free (f32) ;
+  free (s16) ;
+  free (s24) ;
+}
+
+static void
+config_encoder_start (test_encoder *e, vorbis_encode_config *cfg)
+{
+  int ret ;
+
+  vorbis_info_init (&e->vi) ;
+  ret = vorbis_encode_init_config (&e->vi, cfg) ;
+  if (ret) {
+    printf ("\n\nError : vorbis_encode_init_config returned %d.\n", ret) ;
+    exit (1) ;
+  }
+  encoder_start (e) ;
+}
+
+void
+frozen_config_or_die (const float * data, int count)
+{
+  test_encoder ref, a, b ;
+  vorbis_encode_config *cfg ;
+  int ret ;
+
+  vbr_encoder_start (&ref, .3) ;
+  encode_planar (&ref, data, count) ;
+  encoder_finish (&ref) ;
+
+  cfg = vorbis_encode_config_vbr (CHANNELS, RATE, .3) ;
+  if (cfg == NULL) {
+    printf ("\n\nError : vorbis_encode_config_vbr failed.\n") ;
+    exit (1) ;
+  }
+  config_encoder_start (&a, cfg) ;
+  config_encoder_start (&b, cfg) ;
+  /* the encoders keep their configuration alive */
+  vorbis_encode_config_free (cfg) ;
+
+  encode_planar (&a, data, count) ;
+  encoder_finish (&a) ;
+  check_same_or_die ("vorbis_encode_config_vbr", &ref.log, &a.log) ;
+  encode_planar (&b, data, count) ;
+  encoder_finish (&b) ;
+  check_same_or_die ("a second vorbis_encode_config_vbr encoder", &ref.log, &b.log) ;
+  free (ref.log.data) ;
+  free (a.log.data) ;
+  free (b.log.data) ;
+
+  /* freezing a bitrate managed setup; the frozen vorbis_info must
+     still encode as before */
+  packetblobs_encode (&ref, data, count, NULL) ;
+
+  vorbis_info_init (&a.vi) ;
+  ret = vorbis_encode_init (&a.vi, CHANNELS, RATE, -1, 128000, -1) ;
+  if (ret) {
+    printf ("\n\nError : vorbis_encode_init returned %d.\n", ret) ;
+    exit (1) ;
+  }
+  cfg = vorbis_encode_config_new (&a.vi) ;
+  if (cfg == NULL) {
+    printf ("\n\nError : vorbis_encode_config_new failed.\n") ;
+    exit (1) ;
+  }
+  ret = vorbis_encode_init_config (&a.vi, cfg) ;
+  if (ret != OV_EINVAL) {
+    printf ("\n\nError : vorbis_encode_init_config accepted a set up vorbis_info (%d).\n", ret) ;
+    exit (1) ;
+  }
+  config_encoder_start (&b, cfg) ;
+  vorbis_encode_config_free (cfg) ;
+  encoder_start (&a) ;
+
+  encode_planar (&a, data, count) ;
+  encoder_finish (&a) ;
+  check_same_or_die ("a frozen vorbis_info", &ref.log, &a.log) ;
+  encode_planar (&b, data, count) ;
+  encoder_finish (&b) ;
+  check_same_or_die ("vorbis_encode_config_new", &ref.log, &b.log) ;
+  free (ref.log.data) ;
+  free (a.log.data) ;
+  free (b.log.data) ;
+}
+
+/* Decodes a packet log, returning the number of samples per channel
+ * and the peak of the decoded audio. */
+static long
+decode_log_or_die (const packet_log *log, float *peak)
+{
+  vorbis_info      vi ;
+  vorbis_comment   vc ;
+  vorbis_dsp_state vd ;
+  vorbis_block     vb ;
+  ogg_packet       op ;
+  long offset = 0, samples = 0 ;
+  int i, j, n ;
+
+  vorbis_info_init (&vi) ;
+  vorbis_comment_init (&vc) ;
+  memset (&op, 0, sizeof (op)) ;
+  *peak = 0 ;
+
+  for (op.packetno = 0 ; offset < log->bytes ; op.packetno++) {
+    memcpy (&op.bytes, log->data + offset, sizeof (op.bytes)) ;
+    offset += sizeof (op.bytes) ;
+    memcpy (&op.granulepos, log->data + offset, sizeof (op.granulepos)) ;
+    offset += sizeof (op.granulepos) ;
+    memcpy (&op.e_o_s, log->data + offset, sizeof (op.e_o_s)) ;
+    offset += sizeof (op.e_o_s) ;
+    op.packet = log->data + offset ;
+    op.b_o_s = (op.packetno == 0) ;
+    offset += op.bytes ;
+
+    if (op.packetno < 3) {
+      if (vorbis_synthesis_headerin (&vi, &vc, &op)) {
+        printf ("\n\nError : header %ld rejected.\n", (long) op.packetno) ;
+        exit (1) ;
+      }
+      if (op.packetno == 2) {
+        vorbis_synthesis_init (&vd, &vi) ;
+        vorbis_block_init (&vd, &vb) ;
+      }
+    } else {
+      float **pcm ;
+
+      if (vorbis_synthesis (&vb, &op) || vorbis_synthesis_blockin (&vd, &vb)) {
+        printf ("\n\nError : packet %ld rejected.\n", (long) op.packetno) ;
+        exit (1) ;
+      }
+      while ((n = vorbis_synthesis_pcmout (&vd, &pcm)) > 0) {
+        for (j = 0 ; j < vi.channels ; j++)
+          for (i = 0 ; i < n ; i++)
+            if (fabs (pcm [j][i]) > *peak)
+              *peak = fabs (pcm [j][i]) ;
+        vorbis_synthesis_read (&vd, n) ;
+        samples += n ;
+      }
+    }
+  }
+
+  vorbis_block_clear (&vb) ;
+  vorbis_dsp_clear (&vd) ;
+  vorbis_comment_clear (&vc) ;
+  vorbis_info_clear (&vi) ;
+  return samples ;
+}
+
+void
+follow_mode_or_die (const float * data, int count)
+{
+  test_encoder solo, lead, follow ;
+  float peak ;
+  long samples ;
+
+  vbr_encoder_start (&solo, .1) ;
+  encode_planar (&solo, data, count) ;
+  encoder_finish (&solo) ;
+
+  vbr_encoder_start (&lead, .1) ;
+  vbr_encoder_start (&follow, .6) ;
+  lead.follower = &follow ;
+  encode_planar (&lead, data, count) ;
+  encoder_finish (&lead) ;
+  encoder_finish (&follow) ;
+
+  /* the leader is unaffected by its follower */
+  check_same_or_die ("a leader", &solo.log, &lead.log) ;
+
+  /* and the follower is a complete stream of its own quality */
+  samples = decode_log_or_die (&follow.log, &peak) ;
+  if (samples != count) {
+    printf ("\n\nError : follower decodes to %ld samples rather than %d.\n", samples, count) ;
+    exit (1) ;
+  }
+  if (peak < .85 || peak > 1.05) {
+    printf ("\n\nError : follower decodes with a peak of %f.\n", peak) ;
+    exit (1) ;
+  }
+  if (follow.log.bytes <= lead.log.bytes) {
+    printf ("\n\nError : follower is no larger than its lower quality leader.\n") ;
+    exit (1) ;
+  }
+
+  free (solo.log.data) ;
+  free (lead.log.data) ;
+  free (follow.log.data) ;
+
+  /* a follower at another rate is refused */
+  {
+    test_encoder other ;
+    int i, j, ret = 0 ;
+
+    vbr_encoder_start (&lead, .1) ;
+    vorbis_info_init (&other.vi) ;
+    if (vorbis_encode_init_vbr (&other.vi, CHANNELS, 48000, .6)) {
+      printf ("\n\nError : vorbis_encode_init_vbr failed at 48000.\n") ;
+      exit (1) ;
+    }
+    encoder_start (&other) ;
+
+    for (i = 0 ; i < count && ret == 0 ; i += CHUNK) {
+      int n = count - i < CHUNK ? count - i : CHUNK ;
+      float **buffer = vorbis_analysis_buffer (&lead.vd, n) ;
+      for (j = 0 ; j < lead.vi.channels ; j++)
+        memcpy (buffer [j], data + i, n * sizeof (float)) ;
+      vorbis_analysis_wrote (&lead.vd, n) ;
+      if (vorbis_analysis_blockout (&lead.vd, &lead.vb) == 1) {
+        vorbis_analysis (&lead.vb, NULL) ;
+        ret = vorbis_analysis_blockout_follow (&other.vd, &other.vb, &lead.vb) ;
+        if (ret != OV_EINVAL) {
+          printf ("\n\nError : a follower at another rate returned %d.\n", ret) ;
+          exit (1) ;
+        }
+      }
+    }
+    if (ret == 0) {
+      printf ("\n\nError : the leader produced no block.\n") ;
+      exit (1) ;
+    }
+
+    encoder_finish (&lead) ;
+    encoder_finish (&other) ;
+    free (lead.log.data) ;
+    free (other.log.data) ;
+  }
+}
+
+/* As encode_planar(), a sample at a time, returning the most samples
+ * written beyond the last complete packet when the next one came out. */
+static long
+encode_delay (test_encoder *e, const float * data, int count)
+{
+  ogg_packet op ;
+  long delay = 0, done = 0 ;
+  int i, j ;
+
+  for (i = 0 ; i < count ; i++) {
+    float **buffer = vorbis_analysis_buffer (&e->vd, 1) ;
+    for (j = 0 ; j < e->vi.channels ; j++)
+      buffer [j][0] = data [source_index (count, j, i)] ;
+    vorbis_analysis_wrote (&e->vd, 1) ;
+
+    while (vorbis_analysis_blockout (&e->vd, &e->vb) == 1) {
+      vorbis_analysis (&e->vb, NULL) ;
+      vorbis_bitrate_addblock (&e->vb) ;
+      while (vorbis_bitrate_flushpacket (&e->vd, &op)) {
+        if (op.granulepos > 0) {
+          if (i + 1 - done > delay)
+            delay = i + 1 - done ;
+          done = op.granulepos ;
+        }
+        log_packet (&e->log, &op) ;
+      }
+    }
+  }
+  vorbis_analysis_wrote (&e->vd, 0) ;
+  encoder_drain (e) ;
+  return delay ;
+}
+
+void
+latency_or_die (const float * data, int count)
+{
+  static const long caps [] = { 0, 256, 512, 1000 } ;
+  unsigned k ;
+
+  for (k = 0 ; k < sizeof (caps) / sizeof (caps [0]) ; k++) {
+    test_encoder e ;
+    long cap = caps [k], latency, delay, samples ;
+    float peak ;
+    int ret ;
+
+    vorbis_info_init (&e.vi) ;
+    ret = vorbis_encode_setup_vbr (&e.vi, CHANNELS, RATE, .3) ;
+    if (ret == 0)
+      ret = vorbis_encode_ctl (&e.vi, OV_ECTL_LATENCY_SET, &cap) ;
+    if (ret == 0)
+      ret = vorbis_encode_setup_init (&e.vi) ;
+    if (ret == 0)
+      ret = vorbis_encode_ctl (&e.vi, OV_ECTL_LATENCY_GET, &latency) ;
+    if (ret) {
+      printf ("\n\nError : latency setup returned %d.\n", ret) ;
+      exit (1) ;
+    }
+    if (vorbis_encode_ctl (&e.vi, OV_ECTL_LATENCY_GET, NULL) != OV_EINVAL) {
+      printf ("\n\nError : OV_ECTL_LATENCY_GET accepts a NULL argument.\n") ;
+      exit (1) ;
+    }
+    if (cap > 0 && latency > cap) {
+      printf ("\n\nError : latency %ld exceeds the cap of %ld.\n", latency, cap) ;
+      exit (1) ;
+    }
+
+    encoder_start (&e) ;
+    delay = encode_delay (&e, data, count) ;
+    encoder_finish (&e) ;
+
+    if (delay != latency) {
+      printf ("\n\nError : cap %ld reports a latency of %ld but delays by %ld.\n",
+              cap, latency, delay) ;
+      exit (1) ;
+    }
+
+    samples = decode_log_or_die (&e.log, &peak) ;
+    if (samples != count) {
+      printf ("\n\nError : cap %ld decodes to %ld samples rather than %d.\n",
+              cap, samples, count) ;
+      exit (1) ;
+    }
+    free (e.log.data) ;
+  }
+}
+
+void
+speed_or_die (const float * data, int count)
+{
+  int speed, bad ;
+
+  for (speed = 0 ; speed <= OV_SPEED_MAX ; speed++) {
+    int managed ;
+
+    for (managed = 0 ; managed < 2 ; managed++) {
+      test_encoder e ;
+      long samples ;
+      float peak ;
+      int got = -1, ret ;
+
+      vorbis_info_init (&e.vi) ;
+      if (managed)
+        ret = vorbis_encode_setup_managed (&e.vi, CHANNELS, RATE, -1, 96000, -1) ;
+      else
+        ret = vorbis_encode_setup_vbr (&e.vi, CHANNELS, RATE, .4) ;
+      if (ret == 0)
+        ret = vorbis_encode_ctl (&e.vi, OV_ECTL_SPEED_SET, &speed) ;
+      if (ret == 0)
+        ret = vorbis_encode_setup_init (&e.vi) ;
+      if (ret == 0)
+        ret = vorbis_encode_ctl (&e.vi, OV_ECTL_SPEED_GET, &got) ;
+      if (ret) {
+        printf ("\n\nError : speed %d setup returned %d.\n", speed, ret) ;
+        exit (1) ;
+      }
+      if (got != speed) {
+        printf ("\n\nError : speed %d reads back as %d.\n", speed, got) ;
+        exit (1) ;
+      }
+
+      encoder_start (&e) ;
+      encode_planar (&e, data, count) ;
+      encoder_finish (&e) ;
+
+      samples = decode_log_or_die (&e.log, &peak) ;
+      if (samples != count) {
+        printf ("\n\nError : speed %d decodes to %ld samples rather than %d.\n",
+                speed, samples, count) ;
+        exit (1) ;
+      }
+      if (peak < .85 || peak > 1.05) {
+        printf ("\n\nError : speed %d decodes with a peak of %f.\n", speed, peak) ;
+        exit (1) ;
+      }
+      free (e.log.data) ;
+    }
+  }
+
+  /* out of range settings are refused and NULL restores the default */
+  {
+    vorbis_info vi ;
+    int got = -1 ;
+
+    vorbis_info_init (&vi) ;
+    if (vorbis_encode_setup_vbr (&vi, CHANNELS, RATE, .4)) {
+      printf ("\n\nError : vorbis_encode_setup_vbr failed.\n") ;
+      exit (1) ;
+    }
+    speed = OV_SPEED_MAX ;
+    vorbis_encode_ctl (&vi, OV_ECTL_SPEED_SET, &speed) ;
+    bad = OV_SPEED_MAX + 1 ;
+    if (vorbis_encode_ctl (&vi, OV_ECTL_SPEED_SET, &bad) != OV_EINVAL) {
+      printf ("\n\nError : speed %d is accepted.\n", bad) ;
+      exit (1) ;
+    }
+    bad = -1 ;
+    if (vorbis_encode_ctl (&vi, OV_ECTL_SPEED_SET, &bad) != OV_EINVAL) {
+      printf ("\n\nError : speed %d is accepted.\n", bad) ;
+      exit (1) ;
+    }
+    vorbis_encode_ctl (&vi, OV_ECTL_SPEED_GET, &got) ;
+    if (got != OV_SPEED_MAX) {
+      printf ("\n\nError : a refused speed changed the setting to %d.\n", got) ;
+      exit (1) ;
+    }
+    vorbis_encode_ctl (&vi, OV_ECTL_SPEED_SET, NULL) ;
+    vorbis_encode_ctl (&vi, OV_ECTL_SPEED_GET, &got) ;
+    if (got != 0) {
+      printf ("\n\nError : a NULL speed leaves the setting at %d.\n", got) ;
+      exit (1) ;
+    }
+    if (vorbis_encode_ctl (&vi, OV_ECTL_SPEED_GET, NULL) != OV_EINVAL) {
+      printf ("\n\nError : OV_ECTL_SPEED_GET accepts a NULL argument.\n") ;
+      exit (1) ;
+    }
+    vorbis_info_clear (&vi) ;
+  }
+}
@@ -0,0 +1,48 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2012             *
+ * by the Xiph.Org Foundation http://www.xiph.org/                  *
+ *                                                                  *
+ ********************************************************************
+
+ function: encoder tests for vorbis codec test suite.
+ last mod: $Id$
+
+ ********************************************************************/
+
+/* Encode the supplied data with bitrate management, generating the
+ * candidate packets serially, lazily and on several threads, and
+ * check all three produce exactly the same packets. */
+void packetblobs_or_die (const float * data, int count) ;
+
+/* Encode the supplied data as interleaved float, 16 bit and 24 bit
+ * samples, and check each encodes exactly as the same samples written
+ * one channel at a time through vorbis_analysis_buffer() do. */
+void interleaved_writers_or_die (const float * data, int count) ;
+
+/* Encode the supplied data from frozen configurations, made both with
+ * vorbis_encode_config_vbr() and from a finished managed setup, and
+ * check every encoder set up from one, and the frozen setup itself,
+ * encodes exactly as an ordinary encoder with the same setup does. */
+void frozen_config_or_die (const float * data, int count) ;
+
+/* Encode the supplied data at a low quality while a higher quality
+ * encoder follows its block decisions, and check the leader encodes
+ * exactly as it does alone and the follower decodes completely, and
+ * that a follower at another sample rate is refused. */
+void follow_mode_or_die (const float * data, int count) ;
+
+/* Encode the supplied data a sample at a time under several latency
+ * caps, and check the delay OV_ECTL_LATENCY_GET reports is the delay
+ * the encoder actually adds, and each stream decodes completely. */
+void latency_or_die (const float * data, int count) ;
+
+/* Encode the supplied data at every OV_ECTL_SPEED_SET setting, with
+ * and without bitrate management, and check each setting reads back
+ * and each stream decodes completely. */
+void speed_or_die (const float * data, int count) ;
@@ -0,0 +1,388 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2012             *
+ * by the Xiph.Org Foundation http://www.xiph.org/                  *
+ *                                                                  *
+ ********************************************************************
+
+ function: header parsing tests for vorbis codec test suite.
+ last mod: $Id$
+
+ ********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (HAVE_PTHREAD) && defined (__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#include <pthread.h>
+#define CHECK_MEMORY 1
+#endif
+
+#include <vorbis/codec.h>
+#include <vorbis/vorbisenc.h>
+
+#include "headers.h"
+
+/* The three header packets of a stream, in storage of their own. */
+typedef struct {
+  ogg_packet packet [3] ;
+} stream_headers ;
+
+static void
+copy_packet (ogg_packet *dst, const ogg_packet *src)
+{
+  *dst = *src ;
+  dst->packet = malloc (src->bytes) ;
+  if (dst->packet == NULL) {
+    printf ("\n\nError : out of memory.\n") ;
+    exit (1) ;
+  }
+  memcpy (dst->packet, src->packet, src->bytes) ;
+}
+
+/* Makes the headers an encoder writes for the given comments. */
+static void
+make_headers_or_die (stream_headers *h, vorbis_comment *vc)
+{
+  vorbis_info      vi ;
+  vorbis_dsp_state vd ;
+  ogg_packet       header ;
+  ogg_packet       header_comm ;
+  ogg_packet       header_code ;
+  int ret ;
+
+  vorbis_info_init (&vi) ;
+  ret = vorbis_encode_init_vbr (&vi, 2, 44100, .3) ;
+  if (ret) {
+    printf ("\n\nError : vorbis_encode_init_vbr returned %d.\n", ret) ;
+    exit (1) ;
+  }
+  vorbis_analysis_init (&vd, &vi) ;
+  vorbis_analysis_headerout (&vd, vc, &header, &header_comm, &header_code) ;
+  copy_packet (h->packet, &header) ;
+  copy_packet (h->packet + 1, &header_comm) ;
+  copy_packet (h->packet + 2, &header_code) ;
+  vorbis_dsp_clear (&vd) ;
+  vorbis_info_clear (&vi) ;
+}
+
+static void
+free_headers (stream_headers *h)
+{
+  int i ;
+  for (i = 0 ; i < 3 ; i++)
+    free (h->packet [i].packet) ;
+}
+
+/* Reads the identification header and then comm; returns what
+ * vorbis_synthesis_headerin() does with comm. */
+static int
+read_comments (const stream_headers *h, ogg_packet *comm, vorbis_comment *vc)
+{
+  vorbis_info vi ;
+  ogg_packet id = h->packet [0] ;
+  int ret ;
+
+  vorbis_info_init (&vi) ;
+  vorbis_comment_init (vc) ;
+  ret = vorbis_synthesis_headerin (&vi, vc, &id) ;
+  if (ret) {
+    printf ("\n\nError : identification header rejected (%d).\n", ret) ;
+    exit (1) ;
+  }
+  ret = vorbis_synthesis_headerin (&vi, vc, comm) ;
+  vorbis_info_clear (&vi) ;
+  return ret ;
+}
+
+static void
+check_string_or_die (const char *what, const char *a, int alen,
+                     const char *b, int blen)
+{
+  if ((a == NULL) != (b == NULL) || alen != blen ||
+      (a && memcmp (a, b, alen))) {
+    printf ("\n\nError : comment view returns the wrong %s.\n", what) ;
+    exit (1) ;
+  }
+}
+
+void
+comment_view_or_die (void)
+{
+  static const char *tags [] = {
+    "ARTIST", "artist", "Title", "GENRE", "ALBUM", "ARTISTS", "NOEQUALS",
+    "MISSING", ""
+  } ;
+  stream_headers h ;
+  vorbis_comment vc, ref ;
+  vorbis_comment_view *cv ;
+  const char *s ;
+  long bytes ;
+  int i, k, len ;
+
+  vorbis_comment_init (&vc) ;
+  vorbis_comment_add_tag (&vc, "ARTIST", "first") ;
+  vorbis_comment_add_tag (&vc, "TITLE", "a title") ;
+  vorbis_comment_add_tag (&vc, "artist", "second") ;
+  vorbis_comment_add_tag (&vc, "ARTISTS", "not an artist") ;
+  vorbis_comment_add_tag (&vc, "ALBUM", "") ;
+  vorbis_comment_add (&vc, "NOEQUALS") ;
+  /* enough of one tag to need more than a few index buckets */
+  for (i = 0 ; i < 100 ; i++) {
+    char genre [16] ;
+    snprintf (genre, sizeof (genre), "genre %d", i) ;
+    vorbis_comment_add_tag (&vc, "GENRE", genre) ;
+  }
+  make_headers_or_die (&h, &vc) ;
+  vorbis_comment_clear (&vc) ;
+
+  if (read_comments (&h, h.packet + 1, &ref)) {
+    printf ("\n\nError : comment header rejected.\n") ;
+    exit (1) ;
+  }
+  cv = vorbis_comment_view_new (h.packet + 1) ;
+  if (cv == NULL) {
+    printf ("\n\nError : vorbis_comment_view_new rejected a valid header.\n") ;
+    exit (1) ;
+  }
+
+  s = vorbis_comment_view_vendor (cv, &len) ;
+  check_string_or_die ("vendor", s, len, ref.vendor, strlen (ref.vendor)) ;
+  if (vorbis_comment_view_comments (cv) != ref.comments) {
+    printf ("\n\nError : comment view counts %d comments rather than %d.\n",
+            vorbis_comment_view_comments (cv), ref.comments) ;
+    exit (1) ;
+  }
+  for (i = 0 ; i <= ref.comments ; i++) {
+    s = vorbis_comment_view_get (cv, i, &len) ;
+    check_string_or_die ("comment", s, s ? len : 0, ref.user_comments [i],
+                         i < ref.comments ? ref.comment_lengths [i] : 0) ;
+  }
+
+  for (k = 0 ; k < (int) (sizeof (tags) / sizeof (tags [0])) ; k++) {
+    int count = vorbis_comment_query_count (&ref, tags [k]) ;
+    if (vorbis_comment_view_query_count (cv, tags [k]) != count) {
+      printf ("\n\nError : comment view counts %d '%s' tags rather than %d.\n",
+              vorbis_comment_view_query_count (cv, tags [k]), tags [k], count) ;
+      exit (1) ;
+    }
+    for (i = 0 ; i <= count ; i++) {
+      char *value = vorbis_comment_query (&ref, tags [k], i) ;
+      s = vorbis_comment_view_query (cv, tags [k], i, &len) ;
+      check_string_or_die ("tag value", s, s ? len : 0, value,
+                           value ? strlen (value) : 0) ;
+    }
+  }
+  vorbis_comment_view_free (cv) ;
+  vorbis_comment_clear (&ref) ;
+
+  /* every truncation of the header is refused as headerin refuses it */
+  bytes = h.packet [1].bytes ;
+  for (; h.packet [1].bytes >= 0 ; h.packet [1].bytes--) {
+    int bad = read_comments (&h, h.packet + 1, &ref) != 0 ;
+    cv = vorbis_comment_view_new (h.packet + 1) ;
+    if (bad != (cv == NULL)) {
+      printf ("\n\nError : comment view %s a header truncated to %ld bytes.\n",
+              bad ? "accepts" : "refuses", h.packet [1].bytes) ;
+      exit (1) ;
+    }
+    if (cv)
+      vorbis_comment_view_free (cv) ;
+    vorbis_comment_clear (&ref) ;
+  }
+  h.packet [1].bytes = bytes ;
+
+  free_headers (&h) ;
+}
+
+/* Whether a decoder can be set up from the headers, with setup as the
+ * third. */
+static int
+decoder_accepts (const stream_headers *h, ogg_packet *setup)
+{
+  vorbis_info      vi ;
+  vorbis_comment   vc ;
+  vorbis_dsp_state vd ;
+  ogg_packet id = h->packet [0] ;
+  ogg_packet comm = h->packet [1] ;
+  int ok = 0 ;
+
+  vorbis_info_init (&vi) ;
+  vorbis_comment_init (&vc) ;
+  if (vorbis_synthesis_headerin (&vi, &vc, &id) == 0 &&
+      vorbis_synthesis_headerin (&vi, &vc, &comm) == 0 &&
+      vorbis_synthesis_headerin (&vi, &vc, setup) == 0 &&
+      vorbis_synthesis_init (&vd, &vi) == 0) {
+    vorbis_dsp_clear (&vd) ;
+    ok = 1 ;
+  }
+  vorbis_comment_clear (&vc) ;
+  vorbis_info_clear (&vi) ;
+  return ok ;
+}
+
+static void
+check_setup_or_die (const stream_headers *h, ogg_packet *setup,
+                    const char *damage, long where)
+{
+  ogg_packet id = h->packet [0] ;
+  long bytes = -1 ;
+  int ret = vorbis_synthesis_headercheck (&id, setup, &bytes) ;
+
+  if ((ret == 0) != decoder_accepts (h, setup)) {
+    printf ("\n\nError : vorbis_synthesis_headercheck %s a setup header %s %ld.\n",
+            ret ? "refuses" : "accepts", damage, where) ;
+    exit (1) ;
+  }
+  if ((ret == 0) != (bytes > 0)) {
+    printf ("\n\nError : vorbis_synthesis_headercheck returned %d and %ld bytes.\n",
+            ret, bytes) ;
+    exit (1) ;
+  }
+}
+
+#ifdef CHECK_MEMORY
+typedef struct {
+  const stream_headers *h ;
+  long used ;
+} decoder_memory ;
+
+static long
+heap_in_use (void)
+{
+  struct mallinfo2 m = mallinfo2 () ;
+
+  return m.uordblks + m.hblkhd ;
+}
+
+/* Set up a decoder and measure what it takes from the heap.  Run on a
+ * thread of its own, so that no chunks freed by earlier tests are
+ * cached for it. */
+static void *
+measure_decoder (void *arg)
+{
+  decoder_memory *m = arg ;
+  vorbis_info      vi ;
+  vorbis_comment   vc ;
+  vorbis_dsp_state vd ;
+  vorbis_block     vb ;
+  ogg_packet id = m->h->packet [0] ;
+  ogg_packet comm = m->h->packet [1] ;
+  ogg_packet setup = m->h->packet [2] ;
+  long comments ;
+
+  /* the thread's own malloc() state is set up on first use */
+  free (malloc (1)) ;
+
+  vorbis_comment_init (&vc) ;
+  m->used = heap_in_use () ;
+  vorbis_info_init (&vi) ;
+  vorbis_synthesis_headerin (&vi, &vc, &id) ;
+  comments = heap_in_use () ;
+  vorbis_synthesis_headerin (&vi, &vc, &comm) ;
+  m->used += heap_in_use () - comments ;
+  vorbis_synthesis_headerin (&vi, &vc, &setup) ;
+  vorbis_synthesis_init (&vd, &vi) ;
+  vorbis_block_init (&vd, &vb) ;
+  m->used = heap_in_use () - m->used ;
+
+  vorbis_block_clear (&vb) ;
+  vorbis_dsp_clear (&vd) ;
+  vorbis_comment_clear (&vc) ;
+  vorbis_info_clear (&vi) ;
+  return NULL ;
+}
+
+/* The memory vorbis_synthesis_headercheck() reports must cover what
+ * setting up a decoder takes from the heap, and be no more than a
+ * quarter above it. */
+static void
+check_memory_or_die (const stream_headers *h)
+{
+  ogg_packet id = h->packet [0] ;
+  ogg_packet setup = h->packet [2] ;
+  decoder_memory m ;
+  pthread_t thread ;
+  long bytes ;
+
+  if (vorbis_synthesis_headercheck (&id, &setup, &bytes) != 0) {
+    printf ("\n\nError : vorbis_synthesis_headercheck refuses an intact stream.\n") ;
+    exit (1) ;
+  }
+
+  m.h = h ;
+  m.used = 0 ;
+  if (pthread_create (&thread, NULL, measure_decoder, &m)) {
+    printf ("\n\nError : pthread_create failed.\n") ;
+    exit (1) ;
+  }
+  pthread_join (thread, NULL) ;
+
+  /* an allocator other than glibc's own, such as a sanitizer's, leaves
+     nothing to compare against */
+  if (m.used <= 0)
+    return ;
+
+  if (bytes < m.used || bytes > m.used + m.used / 4) {
+    printf ("\n\nError : vorbis_synthesis_headercheck reports %ld bytes for a decoder taking %ld.\n",
+            bytes, m.used) ;
+    exit (1) ;
+  }
+}
+#endif
+
+void
+headercheck_or_die (void)
+{
+  stream_headers h ;
+  vorbis_comment vc ;
+  ogg_packet *setup ;
+  unsigned int seed = 1 ;
+  long bytes ;
+  int i ;
+
+  vorbis_comment_init (&vc) ;
+  make_headers_or_die (&h, &vc) ;
+  vorbis_comment_clear (&vc) ;
+  setup = h.packet + 2 ;
+  bytes = setup->bytes ;
+
+  check_setup_or_die (&h, setup, "intact at", bytes) ;
+#ifdef CHECK_MEMORY
+  check_memory_or_die (&h) ;
+#endif
+
+  /* truncations, every one near the end, where a short read is most
+     easily missed */
+  for (setup->bytes = 0 ; setup->bytes < bytes ; setup->bytes++) {
+    if (setup->bytes < bytes - 64 && setup->bytes % 7)
+      continue ;
+    check_setup_or_die (&h, setup, "truncated to", setup->bytes) ;
+  }
+  setup->bytes = bytes ;
+
+  /* single bit flips */
+  for (i = 0 ; i < 1000 ; i++) {
+    long bit ;
+
+    seed = seed * 1103515245 + 12345 ;
+    bit = (seed >> 8) % (bytes * 8) ;
+    setup->packet [bit >> 3] ^= 1 << (bit & 7) ;
+    check_setup_or_die (&h, setup, "with a flipped bit", bit) ;
+    setup->packet [bit >> 3] ^= 1 << (bit & 7) ;
+  }
+
+  free_headers (&h) ;
+}
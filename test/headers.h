@@ -0,0 +1,29 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2012             *
+ * by the Xiph.Org Foundation http://www.xiph.org/                  *
+ *                                                                  *
+ ********************************************************************
+
+ function: header parsing tests for vorbis codec test suite.
+ last mod: $Id$
+
+ ********************************************************************/
+
+/* Read a comment header with repeated, mixed case and malformed tags
+ * through a vorbis_comment_view, and check the view agrees with the
+ * vorbis_comment vorbis_synthesis_headerin() makes of it, and accepts
+ * a truncated header exactly when vorbis_synthesis_headerin() does. */
+void comment_view_or_die (void) ;
+
+/* Check the memory vorbis_synthesis_headercheck() reports for a stream
+ * against what a decoder for it takes, where the C library can say.
+ * Then damage the setup header by truncating it and by flipping bits
+ * in it, and check vorbis_synthesis_headercheck() accepts each result
+ * exactly when a decoder can be set up from it. */
+void headercheck_or_die (void) ;
@@ -0,0 +1,326 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2012             *
+ * by the Xiph.Org Foundation http://www.xiph.org/                  *
+ *                                                                  *
+ ********************************************************************
+
+ function: vorbisfile tests for vorbis codec test suite.
+ last mod: $Id$
+
+ ********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <vorbis/codec.h>
+#define OV_EXCLUDE_STATIC_CALLBACKS
+#include <vorbis/vorbisfile.h>
+
+#include "ovfile.h"
+
+#define CLONES 4
+
+typedef struct {
+  const char *filename;
+  OggVorbis_File *vf;
+  ogg_int64_t start;
+  float *data;
+  long count;
+  int error;
+} clone_job;
+
+static int
+seek_file (void *file, ogg_int64_t offset, int whence)
+{
+  return fseek (file, offset, whence);
+}
+
+static ov_callbacks file_callbacks = {
+  (size_t (*)(void *, size_t, size_t, void *)) fread,
+  seek_file,
+  (int (*)(void *)) fclose,
+  (long (*)(void *)) ftell
+};
+
+static FILE *
+open_or_die (const char *filename, const char *mode)
+{
+  FILE *file = fopen (filename, mode);
+  if (file == NULL) {
+    printf ("\n\nError : fopen failed : %s\n", strerror (errno)) ;
+    exit (1) ;
+  }
+  return file;
+}
+
+/* Reads the first channel of vf from its current position. */
+static long
+read_channel (OggVorbis_File *vf, float *data, long count)
+{
+  long read_total = 0;
+  int link;
+
+  while (read_total < count) {
+    float **pcm;
+    long samples = ov_read_float (vf, &pcm, count - read_total, &link);
+    if (samples == 0) break;
+    if (samples < 0) return -1;
+    memcpy (data + read_total, pcm[0], samples * sizeof (float));
+    read_total += samples;
+  }
+  return read_total;
+}
+
+static void *
+clone_decode (void *arg)
+{
+  clone_job *job = arg;
+  OggVorbis_File clone;
+  FILE *file = open_or_die (job->filename, "rb");
+
+  if (ov_clone (job->vf, file, &clone, file_callbacks)) {
+    fclose (file);
+    job->error = 1;
+    return NULL;
+  }
+  if (ov_pcm_seek (&clone, job->start))
+    job->error = 1;
+  else
+    job->count = read_channel (&clone, job->data, job->count);
+  ov_clear (&clone);
+  return NULL;
+}
+
+void
+clone_vorbis_data_or_die (const char *filename)
+{
+  OggVorbis_File vf;
+  clone_job jobs [CLONES];
+  float *data;
+  long total, count;
+  int i;
+
+  if (ov_fopen (filename, &vf)) {
+    printf ("\n\nError : ov_fopen failed on '%s'.\n", filename);
+    exit (1) ;
+  }
+  total = ov_pcm_total (&vf, -1);
+  data = malloc (total * sizeof (*data));
+
+  for (i = 0 ; i < CLONES ; i++) {
+    jobs [i].filename = filename;
+    jobs [i].vf = &vf;
+    jobs [i].start = total * i / CLONES;
+    jobs [i].count = total - jobs [i].start;
+    jobs [i].data = malloc (jobs [i].count * sizeof (float));
+    jobs [i].error = 0;
+  }
+
+  /* the clones are made and read while the original is read */
+#ifdef HAVE_PTHREAD
+  {
+    pthread_t threads [CLONES];
+    for (i = 0 ; i < CLONES ; i++)
+      if (pthread_create (threads + i, NULL, clone_decode, jobs + i)) {
+        printf ("\n\nError : pthread_create failed.\n");
+        exit (1) ;
+      }
+    count = read_channel (&vf, data, total);
+    for (i = 0 ; i < CLONES ; i++)
+      pthread_join (threads [i], NULL);
+  }
+#else
+  for (i = 0 ; i < CLONES ; i++)
+    clone_decode (jobs + i);
+  count = read_channel (&vf, data, total);
+#endif
+
+  if (count != total) {
+    printf ("\n\nError : read %ld of %ld samples from '%s'.\n", count, total, filename);
+    exit (1) ;
+  }
+  for (i = 0 ; i < CLONES ; i++) {
+    if (jobs [i].error || jobs [i].count != total - jobs [i].start ||
+        memcmp (jobs [i].data, data + jobs [i].start, jobs [i].count * sizeof (float))) {
+      printf ("\n\nError : clone %d of '%s' decoded differently.\n", i, filename);
+      exit (1) ;
+    }
+    free (jobs [i].data);
+  }
+
+  free (data);
+  ov_clear (&vf);
+}
+
+/* Decodes the first channel of a whole file. */
+static float *
+read_file_or_die (const char *filename, long *count)
+{
+  OggVorbis_File vf;
+  float *data;
+
+  if (ov_fopen (filename, &vf)) {
+    printf ("\n\nError : ov_fopen failed on '%s'.\n", filename);
+    exit (1) ;
+  }
+  *count = ov_pcm_total (&vf, -1);
+  data = malloc (*count * sizeof (*data));
+  if (read_channel (&vf, data, *count) != *count) {
+    printf ("\n\nError : short read from '%s'.\n", filename);
+    exit (1) ;
+  }
+  ov_clear (&vf);
+  return data;
+}
+
+static void
+check_retagged_or_die (const char *filename, const char *vendor,
+                       vorbis_comment *vc, const float *data, long count)
+{
+  OggVorbis_File vf;
+  vorbis_comment *got;
+  float *decoded;
+  long decoded_count;
+  int i;
+
+  if (ov_fopen (filename, &vf)) {
+    printf ("\n\nError : ov_fopen failed on retagged '%s'.\n", filename);
+    exit (1) ;
+  }
+  got = ov_comment (&vf, -1);
+  if (strcmp (got->vendor, vendor) || got->comments != vc->comments) {
+    printf ("\n\nError : '%s' was retagged wrongly.\n", filename);
+    exit (1) ;
+  }
+  for (i = 0 ; i < vc->comments ; i++)
+    if (got->comment_lengths [i] != vc->comment_lengths [i] ||
+        memcmp (got->user_comments [i], vc->user_comments [i], vc->comment_lengths [i])) {
+      printf ("\n\nError : comment %d of '%s' differs.\n", i, filename);
+      exit (1) ;
+    }
+  ov_clear (&vf);
+
+  decoded = read_file_or_die (filename, &decoded_count);
+  if (decoded_count != count || memcmp (decoded, data, count * sizeof (float))) {
+    printf ("\n\nError : retagged '%s' decodes differently.\n", filename);
+    exit (1) ;
+  }
+  free (decoded);
+}
+
+/* Rewrites from into to; returns the ov_comment_rewrite() result. */
+static int
+rewrite_file (const char *from, const char *to, vorbis_comment *vc, long padding)
+{
+  FILE *in = open_or_die (from, "rb");
+  FILE *out = open_or_die (to, "wb");
+  int ret = ov_comment_rewrite (in, file_callbacks, vc, padding,
+                                (size_t (*)(const void *, size_t, size_t, void *)) fwrite, out);
+  fclose (in);
+  fclose (out);
+  return ret;
+}
+
+static void
+add_art_tag (vorbis_comment *vc, long bytes, char fill)
+{
+  char *art = malloc (bytes + 1);
+  memset (art, fill, bytes);
+  art [bytes] = 0;
+  vorbis_comment_add_tag (vc, "METADATA_BLOCK_PICTURE", art);
+  free (art);
+}
+
+void
+rewrite_vorbis_comments_or_die (const char *filename)
+{
+  const char *tagged = "vorbis_retag1.ogg";
+  const char *retagged = "vorbis_retag2.ogg";
+  OggVorbis_File vf;
+  vorbis_comment big, small, smaller;
+  char vendor [256];
+  float *data;
+  long count;
+  int ret;
+
+  if (ov_fopen (filename, &vf)) {
+    printf ("\n\nError : ov_fopen failed on '%s'.\n", filename);
+    exit (1) ;
+  }
+  snprintf (vendor, sizeof (vendor), "%s", ov_comment (&vf, -1)->vendor);
+  ov_clear (&vf);
+  data = read_file_or_die (filename, &count);
+
+  /* 400kB of tags span several comment pages */
+  vorbis_comment_init (&big);
+  vorbis_comment_add_tag (&big, "TITLE", "retagged");
+  add_art_tag (&big, 400000, 'a');
+  ret = rewrite_file (filename, tagged, &big, 0);
+  if (ret) {
+    printf ("\n\nError : ov_comment_rewrite returned %d.\n", ret);
+    exit (1) ;
+  }
+  check_retagged_or_die (tagged, vendor, &big, data, count);
+
+  /* the multi page comment header must be readable in turn */
+  vorbis_comment_init (&small);
+  vorbis_comment_add_tag (&small, "TITLE", "retagged again");
+  ret = rewrite_file (tagged, retagged, &small, 1024);
+  if (ret) {
+    printf ("\n\nError : ov_comment_rewrite of its own output returned %d.\n", ret);
+    exit (1) ;
+  }
+  check_retagged_or_die (retagged, vendor, &small, data, count);
+
+  /* smaller tags fit in place of the big ones; larger ones don't */
+  vorbis_comment_init (&smaller);
+  vorbis_comment_add_tag (&smaller, "TITLE", "in place");
+  add_art_tag (&smaller, 390000, 'b');
+  {
+    FILE *file = open_or_die (tagged, "r+b");
+    ret = ov_comment_rewrite_inplace (file, file_callbacks, &smaller,
+                                      (size_t (*)(const void *, size_t, size_t, void *)) fwrite);
+    fclose (file);
+  }
+  if (ret) {
+    printf ("\n\nError : ov_comment_rewrite_inplace returned %d.\n", ret);
+    exit (1) ;
+  }
+  check_retagged_or_die (tagged, vendor, &smaller, data, count);
+
+  add_art_tag (&big, 1000, 'c');
+  {
+    FILE *file = open_or_die (tagged, "r+b");
+    ret = ov_comment_rewrite_inplace (file, file_callbacks, &big,
+                                      (size_t (*)(const void *, size_t, size_t, void *)) fwrite);
+    fclose (file);
+  }
+  if (ret != OV_FALSE) {
+    printf ("\n\nError : ov_comment_rewrite_inplace returned %d for tags too large.\n", ret);
+    exit (1) ;
+  }
+  check_retagged_or_die (tagged, vendor, &smaller, data, count);
+
+  vorbis_comment_clear (&big);
+  vorbis_comment_clear (&small);
+  vorbis_comment_clear (&smaller);
+  free (data);
+  remove (tagged);
+  remove (retagged);
+}
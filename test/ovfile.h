@@ -0,0 +1,29 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE OggVorbis SOFTWARE CODEC SOURCE CODE.   *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2012             *
+ * by the Xiph.Org Foundation http://www.xiph.org/                  *
+ *                                                                  *
+ ********************************************************************
+
+ function: vorbisfile tests for vorbis codec test suite.
+ last mod: $Id$
+
+ ********************************************************************/
+
+/* Decode the given Ogg/Vorbis file through several ov_clone() views,
+ * each opened and read from its own thread while the original is
+ * being read, and check they all decode exactly what the original
+ * does. */
+void clone_vorbis_data_or_die (const char *filename) ;
+
+/* Retag the given Ogg/Vorbis file with ov_comment_rewrite(), with
+ * comments large enough to span several pages and again after that,
+ * and in place with ov_comment_rewrite_inplace().  Each result must
+ * carry the new comments and the original vendor string and decode
+ * exactly as the original does. */
+void rewrite_vorbis_comments_or_die (const char *filename) ;
@@ -21,6 +21,9 @@
 
 #include "util.h"
 #include "write_read.h"
+#include "ovfile.h"
+#include "encode.h"
+#include "headers.h"
 
 #define DATA_LEN        2048
 
@@ -70,6 +73,76 @@ main(void){
     }
   }
 
+  {
+    static float data_enc [44100 * 2] ;
+
+    printf("\nTesting encoder\n\n");
+    gen_windowed_sine (data_enc, ARRAY_LEN (data_enc), 0.95);
+
+    printf ("    %-20s : ", "packetblobs");
+    fflush (stdout);
+    packetblobs_or_die (data_enc, ARRAY_LEN (data_enc));
+    puts ("ok");
+
+    printf ("    %-20s : ", "interleaved writers");
+    fflush (stdout);
+    interleaved_writers_or_die (data_enc, ARRAY_LEN (data_enc));
+    puts ("ok");
+
+    printf ("    %-20s : ", "frozen configs");
+    fflush (stdout);
+    frozen_config_or_die (data_enc, ARRAY_LEN (data_enc));
+    puts ("ok");
+
+    printf ("    %-20s : ", "follow mode");
+    fflush (stdout);
+    follow_mode_or_die (data_enc, ARRAY_LEN (data_enc));
+    puts ("ok");
+
+    printf ("    %-20s : ", "latency");
+    fflush (stdout);
+    latency_or_die (data_enc, ARRAY_LEN (data_enc));
+    puts ("ok");
+
+    printf ("    %-20s : ", "speed");
+    fflush (stdout);
+    speed_or_die (data_enc, ARRAY_LEN (data_enc));
+    puts ("ok");
+  }
+
+  printf("\nTesting headers\n\n");
+
+  printf ("    %-20s : ", "comment views");
+  fflush (stdout);
+  comment_view_or_die ();
+  puts ("ok");
+
+  printf ("    %-20s : ", "headercheck");
+  fflush (stdout);
+  headercheck_or_die ();
+  puts ("ok");
+
+  {
+    static float data_long [44100 * 4] ;
+    const char *filename = "vorbis_clone.ogg";
+
+    printf("\nTesting vorbisfile\n\n");
+    gen_windowed_sine (data_long, ARRAY_LEN (data_long), 0.95);
+    write_vorbis_data_or_die (filename, 44100, .3, data_long, ARRAY_LEN (data_long), 2);
+
+    printf ("    %-20s : ", "ov_clone");
+    fflush (stdout);
+    clone_vorbis_data_or_die (filename);
+    puts ("ok");
+
+    printf ("    %-20s : ", "ov_comment_rewrite");
+    fflush (stdout);
+    rewrite_vorbis_comments_or_die (filename);
+    puts ("ok");
+
+    remove (filename);
+  }
+
   if (errors)
     exit (1);
 